@@ -0,0 +1,366 @@
+// chip8-aot: statically recompiles a ROM into C source.
+//
+//   chip8-aot rom.ch8 rom.c
+//   gcc -O2 -DCHIP8_AOT_MAIN -I path/to/this/repo rom.c -L path/to/this/repo -lchip8 -o rom
+//
+// The generated file defines load_recompiled_rom() and run_recompiled(). Control flow is reconstructed from 0x200
+// by following fall-through, jump, call and skip edges; every reachable instruction becomes a labelled C statement
+// on the Chip8_t. Returns (00EE) and computed jumps (Bnnn) go back through a switch on pc, and anything that was not
+// reached statically, or that a store has since overwritten, is run by emulate_cycle.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+
+#define ROM_START 0x200
+
+// Flags for every address of the ROM
+#define REACHABLE 1 // an instruction starts here
+#define LEADER 2 // control flow arrives here from somewhere other than the previous instruction
+#define TARGET 4 // a goto in the generated code jumps to this leader's checking label
+
+static unsigned char rom[MEMORY_SIZE];
+static unsigned char flags[MEMORY_SIZE];
+static int rom_end;
+
+static unsigned short opcode_at(int address) {
+    return rom[address] << 8 | rom[address + 1];
+}
+
+static int in_rom(int address) {
+    return address >= ROM_START && address + 1 < rom_end;
+}
+
+// Returns whether the opcode is one the generated code knows. Anything else is left to emulate_cycle.
+static int is_valid(unsigned short opcode) {
+    char text[32];
+    disassemble(opcode, text, sizeof text);
+    return strncmp(text, "DW", 2) != 0 && strncmp(text, "SYS", 3) != 0;
+}
+
+// Walks every path from the entry point and marks reachable instructions and block leaders
+static void discover(void) {
+    static int worklist[MEMORY_SIZE];
+    int pending = 0;
+
+    worklist[pending++] = ROM_START;
+    flags[ROM_START] |= LEADER;
+
+    while (pending > 0) {
+        int address = worklist[--pending];
+        if (!in_rom(address) || (flags[address] & REACHABLE)) {
+            continue;
+        }
+
+        unsigned short opcode = opcode_at(address);
+        if (!is_valid(opcode)) {
+            continue;
+        }
+        flags[address] |= REACHABLE;
+
+        int successors[2];
+        int count = 0;
+        int leaders = 0; // successors arrived at by a jump rather than by falling through
+
+        switch (opcode & 0xF000) {
+            case 0x0000:
+                if (opcode != 0x00EE) {
+                    successors[count++] = address + 2;
+                }
+                break;
+            case 0x1000:
+                successors[count++] = opcode & 0x0FFF;
+                leaders = 1;
+                break;
+            case 0x2000:
+                successors[count++] = opcode & 0x0FFF;
+                successors[count++] = address + 2; // where 00EE comes back to
+                leaders = 2;
+                break;
+            case 0x3000:
+            case 0x4000:
+            case 0x5000:
+            case 0x9000:
+            case 0xE000:
+                successors[count++] = address + 2;
+                successors[count++] = address + 4;
+                leaders = 2;
+                break;
+            case 0xB000:
+                break; // computed target, resolved at run time
+            case 0xF000:
+                successors[count++] = address + 2;
+                // a store may overwrite code and Fx0A may stop the run, so both resume in a fresh block
+                leaders = (opcode & 0x00FF) == 0x33 || (opcode & 0x00FF) == 0x55 || (opcode & 0x00FF) == 0x0A;
+                break;
+            default:
+                successors[count++] = address + 2;
+                break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            int successor = successors[i] & 0x0FFF;
+            // a label only checks the pages of its own instruction, so falling through into another 64-byte page
+            // starts a new block: otherwise a store to that page would leave its old code running
+            int page = address >> 6;
+            int other_page = successor >> 6 != page || ((successor + 1) & 0x0FFF) >> 6 != page;
+            if ((i < leaders || other_page) && in_rom(successor)) {
+                flags[successor] |= LEADER;
+            }
+            worklist[pending++] = successor;
+        }
+    }
+}
+
+// Jump to a known address: to its label when it was recompiled, through the dispatcher otherwise. Block leaders
+// are entered through a label that checks the cycle budget and that the block has not been overwritten.
+static void emit_goto(FILE *out, int address) {
+    address &= 0x0FFF;
+    if (!in_rom(address) || !(flags[address] & REACHABLE)) {
+        fprintf(out, "chip8->pc = 0x%03X; goto dispatch;", address);
+    } else if (flags[address] & LEADER) {
+        flags[address] |= TARGET;
+        fprintf(out, "goto L_%03X;", address);
+    } else {
+        fprintf(out, "goto I_%03X;", address);
+    }
+}
+
+// Emits the statement for the instruction at address. It always ends in a goto, so instructions can be laid out
+// in address order whatever the control flow is.
+static void emit_instruction(FILE *out, int address) {
+    unsigned short opcode = opcode_at(address);
+    int x = (opcode & 0x0F00) >> 8;
+    int y = (opcode & 0x00F0) >> 4;
+    int kk = opcode & 0x00FF;
+    int nnn = opcode & 0x0FFF;
+    int next = (address + 2) & 0x0FFF;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00E0) {
+                fprintf(out, "    opcode_00E0(chip8); ");
+            } else {
+                fprintf(out, "    opcode_00EE(chip8); goto dispatch;\n");
+                return;
+            }
+            break;
+        case 0x1000:
+            fprintf(out, "    ");
+            emit_goto(out, nnn);
+            fprintf(out, "\n");
+            return;
+        case 0x2000:
+            fprintf(out, "    chip8->stack[chip8->sp] = 0x%03X; chip8->sp = (chip8->sp + 1) & (STACK_SIZE - 1); ",
+                    next);
+            emit_goto(out, nnn);
+            fprintf(out, "\n");
+            return;
+        case 0x3000:
+        case 0x4000:
+        case 0x5000:
+        case 0x9000:
+        case 0xE000:
+            switch (opcode & 0xF000) {
+                case 0x3000: fprintf(out, "    if (V[0x%X] == 0x%02X) ", x, kk); break;
+                case 0x4000: fprintf(out, "    if (V[0x%X] != 0x%02X) ", x, kk); break;
+                case 0x5000: fprintf(out, "    if (V[0x%X] == V[0x%X]) ", x, y); break;
+                case 0x9000: fprintf(out, "    if (V[0x%X] != V[0x%X]) ", x, y); break;
+                default:
+                    fprintf(out, "    if (%schip8->keypad[V[0x%X] & 0x0F]) ", kk == 0x9E ? "" : "!", x);
+                    break;
+            }
+            fprintf(out, "{ ");
+            emit_goto(out, address + 4);
+            fprintf(out, " } ");
+            emit_goto(out, next);
+            fprintf(out, "\n");
+            return;
+        case 0x6000: fprintf(out, "    V[0x%X] = 0x%02X; ", x, kk); break;
+        case 0x7000: fprintf(out, "    V[0x%X] += 0x%02X; ", x, kk); break;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0: fprintf(out, "    V[0x%X] = V[0x%X]; ", x, y); break;
+                case 0x1: fprintf(out, "    V[0x%X] |= V[0x%X]; ", x, y); break;
+                case 0x2: fprintf(out, "    V[0x%X] &= V[0x%X]; ", x, y); break;
+                case 0x3: fprintf(out, "    V[0x%X] ^= V[0x%X]; ", x, y); break;
+                case 0x4:
+                    fprintf(out, "    { unsigned s = V[0x%X] + V[0x%X]; V[0x%X] = s & 0xFF; V[0xF] = s > 0xFF; } ",
+                            x, y, x);
+                    break;
+                case 0x5:
+                    fprintf(out, "    { unsigned char f = V[0x%X] >= V[0x%X]; V[0x%X] -= V[0x%X]; V[0xF] = f; } ",
+                            x, y, x, y);
+                    break;
+                case 0x6:
+                    fprintf(out, "    { unsigned char f = V[0x%X] & 1; V[0x%X] >>= 1; V[0xF] = f; } ", x, x);
+                    break;
+                case 0x7:
+                    fprintf(out, "    { unsigned char f = V[0x%X] >= V[0x%X]; V[0x%X] = V[0x%X] - V[0x%X]; "
+                                 "V[0xF] = f; } ", y, x, x, y, x);
+                    break;
+                case 0xE:
+                    fprintf(out, "    { unsigned char f = V[0x%X] >> 7; V[0x%X] <<= 1; V[0xF] = f; } ", x, x);
+                    break;
+            }
+            break;
+        case 0xA000: fprintf(out, "    chip8->I = 0x%03X; ", nnn); break;
+        case 0xB000:
+            fprintf(out, "    chip8->pc = (0x%03X + V[0]) & 0x0FFF; goto dispatch;\n", nnn);
+            return;
+        case 0xC000: fprintf(out, "    opcode_Cxkk(chip8, 0x%X, 0x%02X); ", x, kk); break;
+        case 0xD000: fprintf(out, "    opcode_Dxyn(chip8, 0x%X, 0x%X, %d); ", x, y, opcode & 0x000F); break;
+        case 0xF000:
+            switch (kk) {
+                case 0x07: fprintf(out, "    V[0x%X] = chip8->delay_timer; ", x); break;
+                case 0x0A:
+                    fprintf(out, "    chip8->pc = 0x%03X; opcode_Fx0A(chip8, 0x%X); "
+                                 "if (chip8->pc != 0x%03X) return executed; ", next, x, next);
+                    break;
+                case 0x15: fprintf(out, "    chip8->delay_timer = V[0x%X]; ", x); break;
+                case 0x18: fprintf(out, "    chip8->sound_timer = V[0x%X]; ", x); break;
+                case 0x1E: fprintf(out, "    chip8->I += V[0x%X]; ", x); break;
+                case 0x29: fprintf(out, "    chip8->I = V[0x%X] * 0x05; ", x); break;
+                case 0x33: fprintf(out, "    opcode_Fx33(chip8, 0x%X); ", x); break;
+                case 0x55: fprintf(out, "    opcode_Fx55(chip8, 0x%X); ", x); break;
+                case 0x65: fprintf(out, "    opcode_Fx65(chip8, 0x%X); ", x); break;
+            }
+            break;
+    }
+
+    emit_goto(out, next);
+    fprintf(out, "\n");
+}
+
+static unsigned long long code_pages(void) {
+    unsigned long long pages = 0;
+    for (int address = ROM_START; address < rom_end; address++) {
+        if (flags[address] & REACHABLE) {
+            pages |= 1ULL << (address >> 6);
+            pages |= 1ULL << (((address + 1) & 0x0FFF) >> 6);
+        }
+    }
+    return pages;
+}
+
+static void emit_program(FILE *out, const char *rom_path) {
+    char text[32];
+
+    fprintf(out, "// Recompiled from %s by chip8-aot. Do not edit.\n", rom_path);
+    fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n");
+    fprintf(out, "#include \"cpu.h\"\n\n");
+    fprintf(out, "#define RECOMPILED_CODE_PAGES 0x%016llXULL\n\n", code_pages());
+
+    fprintf(out, "static const unsigned char recompiled_rom[%d] = {", rom_end - ROM_START);
+    for (int address = ROM_START; address < rom_end; address++) {
+        fprintf(out, "%s0x%02X,", (address - ROM_START) % 16 == 0 ? "\n    " : " ", rom[address]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "// Copies the ROM into a machine that has just been through init_chip8\n");
+    fprintf(out, "void load_recompiled_rom(Chip8_t *chip8) {\n");
+    fprintf(out, "    memcpy(chip8->memory + 0x%03X, recompiled_rom, sizeof recompiled_rom);\n", ROM_START);
+    fprintf(out, "    flush_decode_cache(chip8);\n");
+    fprintf(out, "    chip8->code_pages[CODE_CACHE_AOT] = RECOMPILED_CODE_PAGES;\n");
+    fprintf(out, "    chip8->written_code_pages[CODE_CACHE_AOT] = 0;\n");
+    fprintf(out, "}\n\n");
+
+    // The body first, into a buffer, so that we know which labels it jumps to before writing the dispatcher
+    FILE *body_out = tmpfile();
+    if (!body_out) {
+        fprintf(stderr, "Unable to create a temporary file\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int address = ROM_START; address < rom_end; address++) {
+        if (!(flags[address] & REACHABLE)) {
+            continue;
+        }
+        unsigned short opcode = opcode_at(address);
+        disassemble(opcode, text, sizeof text);
+        fprintf(body_out, "I_%03X: // %04X %s\n", address, opcode, text);
+        fprintf(body_out, "    executed++;\n");
+        emit_instruction(body_out, address);
+    }
+    fprintf(out, "// Runs at least cycles instructions, or until Fx0A waits for a key, and returns how many ran\n");
+    fprintf(out, "int run_recompiled(Chip8_t *chip8, int cycles) {\n");
+    fprintf(out, "    unsigned char *V = chip8->V;\n");
+    fprintf(out, "    const unsigned long long *written = &chip8->written_code_pages[CODE_CACHE_AOT];\n");
+    fprintf(out, "    int executed = 0;\n\n");
+    fprintf(out, "dispatch:\n");
+    fprintf(out, "    if (executed >= cycles) {\n        return executed;\n    }\n");
+    fprintf(out, "    if (*written & ((1ULL << ((chip8->pc & 0x0FFF) >> 6)) |\n");
+    fprintf(out, "                    (1ULL << (((chip8->pc + 1) & 0x0FFF) >> 6)))) {\n");
+    fprintf(out, "        goto interpret;\n    }\n");
+    fprintf(out, "    switch (chip8->pc & 0x0FFF) {\n");
+    for (int address = ROM_START; address < rom_end; address++) {
+        if (flags[address] & REACHABLE) {
+            fprintf(out, "        case 0x%03X: goto I_%03X;\n", address, address);
+        }
+    }
+    fprintf(out, "        default: goto interpret;\n    }\n\n");
+    fprintf(out, "interpret:\n");
+    fprintf(out, "    emulate_cycle(chip8);\n    executed++;\n    goto dispatch;\n\n");
+
+    // Labels that gotos land on check the budget and that their code is still the code that was recompiled
+    for (int address = ROM_START; address < rom_end; address++) {
+        if (flags[address] & TARGET) {
+            fprintf(out, "L_%03X:\n", address);
+            fprintf(out, "    if (executed >= cycles || (*written & 0x%016llXULL)) {\n",
+                    (1ULL << (address >> 6)) | (1ULL << (((address + 1) & 0x0FFF) >> 6)));
+            fprintf(out, "        chip8->pc = 0x%03X;\n        goto dispatch;\n    }\n", address);
+            fprintf(out, "    goto I_%03X;\n", address);
+        }
+    }
+    fprintf(out, "\n");
+
+    rewind(body_out);
+    int c;
+    while ((c = fgetc(body_out)) != EOF) {
+        fputc(c, out);
+    }
+    fclose(body_out);
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "#ifdef CHIP8_AOT_MAIN\n");
+    fprintf(out, "// Runs the ROM headless for the given number of instructions and prints the final registers\n");
+    fprintf(out, "int main(int argc, char **argv) {\n");
+    fprintf(out, "    static Chip8_t chip8;\n");
+    fprintf(out, "    long cycles = argc > 1 ? atol(argv[1]) : 1000000;\n");
+    fprintf(out, "    init_chip8(&chip8);\n");
+    fprintf(out, "    load_recompiled_rom(&chip8);\n");
+    fprintf(out, "    while (cycles > 0) {\n");
+    fprintf(out, "        int executed = run_recompiled(&chip8, cycles > 1000000 ? 1000000 : (int)cycles);\n");
+    fprintf(out, "        if (executed == 0) {\n            break;\n        }\n");
+    fprintf(out, "        cycles -= executed;\n    }\n");
+    fprintf(out, "    for (int i = 0; i < REGISTER_SIZE; i++) {\n");
+    fprintf(out, "        printf(\"V%%X=%%02X \", i, chip8.V[i]);\n    }\n");
+    fprintf(out, "    printf(\"I=%%03X PC=%%03X\\n\", chip8.I, chip8.pc);\n");
+    fprintf(out, "    return EXIT_SUCCESS;\n}\n#endif\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s rom.ch8 output.c\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "Unable to open ROM %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    rom_end = ROM_START + (int)fread(rom + ROM_START, 1, MEMORY_SIZE - ROM_START, in);
+    fclose(in);
+
+    discover();
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        fprintf(stderr, "Unable to create %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    emit_program(out, argv[1]);
+    fclose(out);
+
+    return EXIT_SUCCESS;
+}
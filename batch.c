@@ -0,0 +1,388 @@
+// chip8-batch: runs many ROM and input combinations headless across every core and writes one CSV row per job.
+//
+//   chip8-batch [--threads threads] [--ipf instructions per frame] manifest.txt results.csv
+//
+// Each line of the manifest is a job: a ROM, its budget in instructions and optionally an input script. Blank lines
+// and lines starting with # are skipped.
+//
+//   roms/bounce.ch8 1000000
+//   game.ch8 5000000 inputs/start-and-fire.txt
+//
+// An input script holds the keys down from a frame on, one "frame keys" pair per line, with the keys as a hex mask
+// whose bit k is key k (so "120 0010" presses key 4 at frame 120 and "180 0" releases it), and at most
+// BATCH_MAX_KEY_CHANGES of them: a job whose script has more fails rather than running without the rest. A job runs
+// ceil(instructions / ipf) frames exactly as the frontend would with those keys held, and its row records the final
+// screen hash, registers and how long it took. Rows are written in manifest order whatever order the jobs ran in.
+//
+// Jobs are spread over a work-stealing pool: every worker starts with an even share of the jobs and takes them from
+// the front of its own range; a worker whose range is empty steals the back half of another's, so a few long jobs
+// can't leave cores idle while one worker still has a queue behind them.
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE // sysconf
+#endif
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "cpu.h"
+
+#define BATCH_MAX_THREADS 256
+#define BATCH_MAX_KEY_CHANGES 1024 // lines one input script may have; a job whose script has more fails
+#define BATCH_PATH_SIZE 512
+
+// KeyChange_t is one line of an input script: keys held from frame on
+typedef struct {
+    long frame;
+    unsigned int keys;
+} KeyChange_t;
+
+// Job_t is a struct that contains one manifest line and, once a worker has run it, its result
+typedef struct {
+    char rom[BATCH_PATH_SIZE];
+    char inputs[BATCH_PATH_SIZE]; // empty when no keys are pressed
+    long instructions;
+
+    const char *error; // NULL if the job ran
+    long frames;
+    long executed;
+    uint64_t screen_hash;
+    unsigned char V[REGISTER_SIZE];
+    unsigned short I;
+    unsigned short pc;
+    double milliseconds;
+} Job_t;
+
+// JobRange_t packs a worker's share of the jobs, [next, end), into one word so that taking from the front and
+// stealing from the back are both a single compare-and-swap
+typedef atomic_ullong JobRange_t;
+
+#define RANGE(next, end) ((unsigned long long)(end) << 32 | (unsigned long long)(next))
+#define RANGE_NEXT(range) ((unsigned int)((range) & 0xFFFFFFFFu))
+#define RANGE_END(range) ((unsigned int)((range) >> 32))
+
+// Batch_t is a struct that contains the jobs and the pool that runs them
+typedef struct {
+    Job_t *jobs;
+    int job_count;
+    int ipf;
+    int threads;
+    JobRange_t ranges[BATCH_MAX_THREADS];
+} Batch_t;
+
+// Worker_t is one thread of the pool and the machine it reuses for every job it runs
+typedef struct {
+    Batch_t *batch;
+    int index;
+    Chip8_t *chip8;
+    KeyChange_t key_changes[BATCH_MAX_KEY_CHANGES];
+} Worker_t;
+
+static double now_milliseconds(void) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec * 1e3 + (double)now.tv_nsec * 1e-6;
+}
+
+int host_threads(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+// FNV-1a over the screen, a row at a time from the top and each row from its leftmost pixel
+uint64_t hash_screen(const Chip8_t *chip8) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            hash ^= (chip8->gfx[y] >> shift) & 0xFF;
+            hash *= 0x100000001B3ULL;
+        }
+    }
+    return hash;
+}
+
+// Reads an input script, whose lines must be in frame order, into key_changes; returns how many it held, or -1 with
+// error saying why
+static int load_inputs(const char *path, KeyChange_t *key_changes, const char **error) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        *error = "unreadable input script";
+        return -1;
+    }
+
+    int count = 0;
+    char line[128];
+    while (fgets(line, sizeof line, file)) {
+        long frame;
+        unsigned int keys;
+        if (line[0] == '#' || sscanf(line, "%ld %x", &frame, &keys) != 2) {
+            continue;
+        }
+        if (count == BATCH_MAX_KEY_CHANGES) {
+            fclose(file);
+            *error = "too many key changes in input script";
+            return -1;
+        }
+        key_changes[count].frame = frame;
+        key_changes[count].keys = keys;
+        count++;
+    }
+
+    fclose(file);
+    return count;
+}
+
+static void run_job(Worker_t *worker, Job_t *job) {
+    Chip8_t *chip8 = worker->chip8;
+    double start = now_milliseconds();
+
+    int key_change_count = 0;
+    if (job->inputs[0]) {
+        key_change_count = load_inputs(job->inputs, worker->key_changes, &job->error);
+        if (key_change_count < 0) {
+            return;
+        }
+    }
+
+    init_chip8(chip8);
+    if (!load_rom(chip8, job->rom)) {
+        job->error = "unreadable ROM";
+        return;
+    }
+
+    int ipf = worker->batch->ipf;
+    long frames = (job->instructions + ipf - 1) / ipf;
+    int next_change = 0;
+    job->executed = 0;
+    for (long frame = 0; frame < frames; frame++) {
+        while (next_change < key_change_count && worker->key_changes[next_change].frame <= frame) {
+            unsigned int keys = worker->key_changes[next_change++].keys;
+            for (int i = 0; i < 16; i++) {
+                chip8->keypad[i] = keys >> i & 1;
+            }
+        }
+        job->executed += run_frame(chip8, ipf);
+    }
+
+    job->error = NULL;
+    job->frames = frames;
+    job->screen_hash = hash_screen(chip8);
+    memcpy(job->V, chip8->V, sizeof job->V);
+    job->I = chip8->I;
+    job->pc = chip8->pc;
+    job->milliseconds = now_milliseconds() - start;
+}
+
+// Takes the next job from the front of a worker's own range; returns -1 once it is empty
+static int take_job(JobRange_t *range) {
+    unsigned long long current = atomic_load(range);
+    while (RANGE_NEXT(current) < RANGE_END(current)) {
+        unsigned long long taken = RANGE(RANGE_NEXT(current) + 1, RANGE_END(current));
+        if (atomic_compare_exchange_weak(range, &current, taken)) {
+            return (int)RANGE_NEXT(current);
+        }
+    }
+    return -1;
+}
+
+// Moves the back half of another worker's range into the thief's own (which is empty); returns 0 if every range is
+// empty, which means the batch is finished since jobs are never added
+static int steal_jobs(Batch_t *batch, int thief) {
+    for (int i = 1; i < batch->threads; i++) {
+        JobRange_t *victim = &batch->ranges[(thief + i) % batch->threads];
+        unsigned long long current = atomic_load(victim);
+        while (RANGE_NEXT(current) < RANGE_END(current)) {
+            unsigned int next = RANGE_NEXT(current), end = RANGE_END(current);
+            unsigned int middle = next + (end - next) / 2; // the victim keeps [next, middle), the thief [middle, end)
+            if (atomic_compare_exchange_weak(victim, &current, RANGE(next, middle))) {
+                atomic_store(&batch->ranges[thief], RANGE(middle, end));
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void *worker_thread(void *data) {
+    Worker_t *worker = data;
+    Batch_t *batch = worker->batch;
+
+    do {
+        int job;
+        while ((job = take_job(&batch->ranges[worker->index])) >= 0) {
+            run_job(worker, &batch->jobs[job]);
+        }
+    } while (steal_jobs(batch, worker->index));
+
+    return NULL;
+}
+
+// Reads the manifest into batch->jobs; returns 0 if it can't be read or holds no jobs
+static int load_manifest(Batch_t *batch, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    int capacity = 0;
+    char line[2 * BATCH_PATH_SIZE + 64];
+    while (fgets(line, sizeof line, file)) {
+        Job_t job = {0};
+        char rom[BATCH_PATH_SIZE], inputs[BATCH_PATH_SIZE] = "";
+        if (line[0] == '#' || sscanf(line, "%511s %ld %511s", rom, &job.instructions, inputs) < 2) {
+            continue;
+        }
+        strcpy(job.rom, rom);
+        strcpy(job.inputs, inputs);
+        job.error = "not run";
+
+        if (batch->job_count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            Job_t *jobs = realloc(batch->jobs, (size_t)capacity * sizeof *jobs);
+            if (!jobs) {
+                fclose(file);
+                return 0;
+            }
+            batch->jobs = jobs;
+        }
+        batch->jobs[batch->job_count++] = job;
+    }
+
+    fclose(file);
+    return batch->job_count > 0;
+}
+
+// Writes a path as a quoted CSV field, doubling any quotes in it (RFC 4180), so commas and quotes can't split a row
+static void write_path(FILE *file, const char *path) {
+    fputc('"', file);
+    for (; *path; path++) {
+        if (*path == '"') {
+            fputc('"', file);
+        }
+        fputc(*path, file);
+    }
+    fputc('"', file);
+}
+
+static int write_results(const Batch_t *batch, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return 0;
+    }
+
+    fprintf(file, "job,rom,inputs,status,frames,instructions,screen_hash,registers,I,PC,milliseconds\n");
+    for (int i = 0; i < batch->job_count; i++) {
+        const Job_t *job = &batch->jobs[i];
+        fprintf(file, "%d,", i);
+        write_path(file, job->rom);
+        fputc(',', file);
+        write_path(file, job->inputs);
+        if (job->error) {
+            fprintf(file, ",%s,,,,,,,\n", job->error);
+            continue;
+        }
+        char registers[2 * REGISTER_SIZE + 1];
+        for (int r = 0; r < REGISTER_SIZE; r++) {
+            snprintf(&registers[2 * r], 3, "%02X", job->V[r]);
+        }
+        fprintf(file, ",ok,%ld,%ld,%016llX,%s,%03X,%03X,%.3f\n", job->frames, job->executed,
+                (unsigned long long)job->screen_hash, registers, job->I, job->pc, job->milliseconds);
+    }
+
+    fclose(file);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    static Batch_t batch;
+    batch.ipf = CYCLES_PER_FRAME;
+    batch.threads = host_threads();
+
+    const char *paths[2];
+    int path_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            batch.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+            batch.ipf = atoi(argv[++i]);
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        }
+    }
+    if (path_count != 2 || batch.ipf < 1 || batch.threads < 1) {
+        fprintf(stderr, "usage: %s [--threads threads] [--ipf instructions per frame] manifest.txt results.csv\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!load_manifest(&batch, paths[0])) {
+        fprintf(stderr, "Unable to read any jobs from %s\n", paths[0]);
+        return EXIT_FAILURE;
+    }
+    if (batch.threads > BATCH_MAX_THREADS) {
+        batch.threads = BATCH_MAX_THREADS;
+    }
+    if (batch.threads > batch.job_count) {
+        batch.threads = batch.job_count;
+    }
+
+    static Worker_t workers[BATCH_MAX_THREADS];
+    for (int i = 0; i < batch.threads; i++) {
+        workers[i].batch = &batch;
+        workers[i].index = i;
+        workers[i].chip8 = malloc(sizeof *workers[i].chip8);
+        if (!workers[i].chip8) {
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+//        even shares, the first job_count % threads workers taking one extra
+        int begin = (int)((long)batch.job_count * i / batch.threads);
+        int end = (int)((long)batch.job_count * (i + 1) / batch.threads);
+        atomic_init(&batch.ranges[i], RANGE(begin, end));
+    }
+//    builds the shared decode table before any worker can race to
+    init_chip8(workers[0].chip8);
+
+    double start = now_milliseconds();
+    pthread_t threads[BATCH_MAX_THREADS];
+    int started = 0;
+    while (started < batch.threads && pthread_create(&threads[started], NULL, worker_thread, &workers[started]) == 0) {
+        started++;
+    }
+//    a worker that failed to start leaves its range to be stolen, and if none started this thread does the work
+    if (started == 0) {
+        worker_thread(&workers[0]);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double milliseconds = now_milliseconds() - start;
+
+    int failed = 0;
+    for (int i = 0; i < batch.job_count; i++) {
+        failed += batch.jobs[i].error != NULL;
+    }
+    if (!write_results(&batch, paths[1])) {
+        fprintf(stderr, "Unable to write %s\n", paths[1]);
+        return EXIT_FAILURE;
+    }
+    printf("%d jobs (%d failed) on %d threads in %.1f ms\n", batch.job_count, failed, batch.threads, milliseconds);
+
+    for (int i = 0; i < batch.threads; i++) {
+        free(workers[i].chip8);
+    }
+    free(batch.jobs);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
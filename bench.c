@@ -0,0 +1,328 @@
+// chip8-bench: measures emulation speed and prints it as CSV on stdout.
+//
+//   chip8-bench [--runs runs] [--instructions instructions] [--ipf instructions per frame] [rom.ch8 ...]
+//   chip8-bench --draw [--runs runs] [--instructions draws]
+//
+// Every benchmark is run on every engine: run_cycles (the interpreter the frontend uses), run_threaded, run_blocks
+// and, where the host supports it, run_jit. The microbenchmarks are tight loops over one opcode family each; the
+// ROMs given on the command line are the macrobenchmarks. Each run starts from a freshly loaded machine and plays
+// instructions / ipf frames headless, ticking the timers between frames, and is timed as a whole. Instructions that
+// run_cycles skips in a wait loop count as executed, since the machine ends up where executing them would leave it;
+// the skipped column says how many of them there were.
+//
+// --draw times nothing but Dxyn instead: the same random sprites, at random places and addresses, drawn by
+// opcode_Dxyn (the vector blitter where the build has one) and by opcode_Dxyn_scalar, once each to check that the
+// screen and VF agree after every draw (failing if not), then timed, with draws as the instructions.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu.h"
+#include "block.h"
+#include "jit.h"
+
+#define DEFAULT_RUNS 5
+#define DEFAULT_INSTRUCTIONS 20000000L
+#define DEFAULT_IPF 1000
+#define DRAWS 4096 // distinct sprites in the --draw benchmark, drawn in turn
+
+// Microbench_t is a struct that contains a synthetic program, loaded at 0x200 and looping back to it
+typedef struct {
+    const char *name;
+    const unsigned short *program;
+    int length;
+} Microbench_t;
+
+// Every loop bumps a counter that no skip can jump over, so that none of them looks like a wait loop
+static const unsigned short alu_program[] = {
+    0x8014, 0x8125, 0x8231, 0x8302, 0x8016, 0x811E, 0x8233, 0x8307, 0x8340, 0x7501, 0x1200,
+};
+static const unsigned short skip_program[] = {
+    0x3000, 0x6F00, 0x4001, 0x6F00, 0x5010, 0x6F00, 0x9010, 0x6F00, 0xE09E, 0x6F00, 0x7001, 0x1200,
+};
+static const unsigned short draw_program[] = {
+    0xA000, 0xD015, 0x7003, 0x7101, 0x1200,
+};
+static const unsigned short memory_program[] = {
+    0xA300, 0xF033, 0xF355, 0xF365, 0x7001, 0x1200,
+};
+static const unsigned short call_program[] = {
+    0x2206, 0x7001, 0x1200, 0x00EE,
+};
+
+static const Microbench_t microbenches[] = {
+    {"alu 8xyN", alu_program, sizeof alu_program / sizeof alu_program[0]},
+    {"skip 3xkk/4xkk/5xy0/9xy0/Ex9E", skip_program, sizeof skip_program / sizeof skip_program[0]},
+    {"draw Annn/Dxyn", draw_program, sizeof draw_program / sizeof draw_program[0]},
+    {"memory Fx33/Fx55/Fx65", memory_program, sizeof memory_program / sizeof memory_program[0]},
+    {"call 2nnn/00EE", call_program, sizeof call_program / sizeof call_program[0]},
+};
+
+typedef enum {
+    ENGINE_CYCLES,
+    ENGINE_THREADED,
+    ENGINE_BLOCKS,
+    ENGINE_JIT,
+    ENGINE_COUNT
+} Engine_t;
+
+static const char *const engine_names[ENGINE_COUNT] = {"cycles", "threaded", "blocks", "jit"};
+
+// Draw_t is a struct that contains the operands of one Dxyn in the --draw benchmark
+typedef struct {
+    unsigned short I;
+    unsigned char column;
+    unsigned char row;
+    unsigned char n;
+} Draw_t;
+
+typedef void (*DrawFunction_t)(Chip8_t *chip8, unsigned short x, unsigned short y, unsigned short n);
+
+// Bench_t is a struct that contains the settings and the engines' state, shared by every benchmark
+typedef struct {
+    int runs;
+    long instructions;
+    int ipf;
+    Chip8_t chip8;
+    BlockCache_t *blocks;
+    Jit_t *jit; // NULL when this host can't run the JIT
+} Bench_t;
+
+// Timing_t is a struct that contains the runs of one benchmark timed so far
+typedef struct {
+    int runs;
+    double mips_sum;
+    double mips_sum_squares;
+    double ns_sum;
+    double ns_min;
+} Timing_t;
+
+static double now_seconds(void) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void add_run(Timing_t *timing, long executed, double seconds) {
+    double mips = (double)executed / seconds / 1e6;
+    double ns = seconds * 1e9 / (double)executed;
+    timing->mips_sum += mips;
+    timing->mips_sum_squares += mips * mips;
+    timing->ns_sum += ns;
+    if (timing->runs == 0 || ns < timing->ns_min) {
+        timing->ns_min = ns;
+    }
+    timing->runs++;
+}
+
+static void print_timing(const Timing_t *timing, const char *name, const char *engine, long executed,
+                         unsigned long long skipped) {
+    double mips_mean = timing->mips_sum / timing->runs;
+    double variance = timing->mips_sum_squares / timing->runs - mips_mean * mips_mean;
+    printf("\"%s\",%s,%ld,%llu,%d,%.2f,%.2f,%.3f,%.3f\n", name, engine, executed, skipped, timing->runs, mips_mean,
+           sqrt(variance > 0 ? variance : 0), timing->ns_sum / timing->runs, timing->ns_min);
+    fflush(stdout);
+}
+
+// Runs one frame on the given engine, ticking the timers after it, and returns how many instructions it executed
+static long run_engine_frame(Bench_t *bench, Engine_t engine) {
+    Chip8_t *chip8 = &bench->chip8;
+    long executed = 0;
+
+    switch (engine) {
+        case ENGINE_CYCLES: {
+            executed = run_frame(chip8, bench->ipf);
+        } break;
+        case ENGINE_THREADED: {
+            executed = run_threaded(chip8, bench->ipf);
+            tick_timers(chip8);
+        } break;
+        case ENGINE_BLOCKS: {
+            executed = run_blocks(bench->blocks, chip8, bench->ipf);
+            tick_timers(chip8);
+        } break;
+        case ENGINE_JIT: {
+            executed = run_jit(bench->jit, chip8, bench->ipf);
+            tick_timers(chip8);
+        } break;
+        default: break;
+    }
+    return executed;
+}
+
+// Times the program already in memory (image, copied to 0x200) on one engine and prints its CSV row
+static void run_benchmark(Bench_t *bench, const char *name, const unsigned char *image, size_t size, Engine_t engine) {
+    Timing_t timing = {0};
+    long frames = bench->instructions / bench->ipf;
+    long executed = 0;
+
+    for (int run = 0; run < bench->runs; run++) {
+        init_chip8(&bench->chip8);
+        memcpy(&bench->chip8.memory[0x200], image, size);
+        flush_decode_cache(&bench->chip8);
+        flush_block_cache(bench->blocks, &bench->chip8);
+        if (bench->jit) {
+            flush_jit(bench->jit, &bench->chip8);
+        }
+
+        executed = 0;
+        double start = now_seconds();
+        for (long frame = 0; frame < frames; frame++) {
+            executed += run_engine_frame(bench, engine);
+        }
+        add_run(&timing, executed, now_seconds() - start);
+    }
+    print_timing(&timing, name, engine_names[engine], executed, bench->chip8.idle_cycles);
+}
+
+static uint32_t next_random(uint32_t *random) {
+    *random ^= *random << 13;
+    *random ^= *random >> 17;
+    *random ^= *random << 5;
+    return *random;
+}
+
+// A machine with random sprite data everywhere past the font, and random draws of it. Addresses go right up to the
+// end of memory, so that the vector blitter's fallback for sprites it can't load whole gets drawn too.
+static void make_draws(Chip8_t *chip8, Draw_t *draws) {
+    uint32_t random = 0x2545F491;
+    init_chip8(chip8);
+    for (int address = 0x200; address < MEMORY_SIZE; address++) {
+        chip8->memory[address] = next_random(&random) & 0xFF;
+    }
+    flush_decode_cache(chip8);
+    for (int i = 0; i < DRAWS; i++) {
+        draws[i].I = next_random(&random) & 0x0FFF;
+        draws[i].column = next_random(&random) & 0xFF;
+        draws[i].row = next_random(&random) & 0xFF;
+        draws[i].n = 1 + next_random(&random) % 15;
+    }
+}
+
+static void draw(Chip8_t *chip8, DrawFunction_t function, const Draw_t *operands) {
+    chip8->I = operands->I;
+    chip8->V[0] = operands->column;
+    chip8->V[1] = operands->row;
+    function(chip8, 0, 1, operands->n);
+}
+
+// The --draw benchmark; returns 0 if the two blitters disagree
+static int run_draw_benchmark(Bench_t *bench) {
+    static const DrawFunction_t functions[] = {opcode_Dxyn, opcode_Dxyn_scalar};
+    static const char *const names[] = {"opcode_Dxyn", "opcode_Dxyn_scalar"};
+    static Chip8_t start, scalar;
+    static Draw_t draws[DRAWS];
+    make_draws(&start, draws);
+
+    bench->chip8 = start;
+    scalar = start;
+    for (int i = 0; i < DRAWS; i++) {
+        draw(&bench->chip8, opcode_Dxyn, &draws[i]);
+        draw(&scalar, opcode_Dxyn_scalar, &draws[i]);
+        if (memcmp(bench->chip8.gfx, scalar.gfx, sizeof scalar.gfx) != 0 || bench->chip8.V[0xF] != scalar.V[0xF]) {
+            fprintf(stderr, "Draw %d (I=%03X at %d,%d, %d rows): opcode_Dxyn and opcode_Dxyn_scalar disagree\n", i,
+                    draws[i].I, draws[i].column, draws[i].row, draws[i].n);
+            return 0;
+        }
+    }
+
+    for (size_t f = 0; f < sizeof functions / sizeof functions[0]; f++) {
+        Timing_t timing = {0};
+        for (int run = 0; run < bench->runs; run++) {
+            bench->chip8 = start;
+            double begin = now_seconds();
+            for (long i = 0; i < bench->instructions; i++) {
+                draw(&bench->chip8, functions[f], &draws[i % DRAWS]);
+            }
+            add_run(&timing, bench->instructions, now_seconds() - begin);
+        }
+        print_timing(&timing, "draw Dxyn only", names[f], bench->instructions, 0);
+    }
+    return 1;
+}
+
+static void run_all_engines(Bench_t *bench, const char *name, const unsigned char *image, size_t size) {
+    for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+        if (engine == ENGINE_JIT && !bench->jit) {
+            continue;
+        }
+        run_benchmark(bench, name, image, size, engine);
+    }
+}
+
+int main(int argc, char **argv) {
+    static Bench_t bench;
+    bench.runs = DEFAULT_RUNS;
+    bench.instructions = DEFAULT_INSTRUCTIONS;
+    bench.ipf = DEFAULT_IPF;
+
+    int first_rom = argc;
+    int draw_only = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--draw") == 0) {
+            draw_only = 1;
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            bench.runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--instructions") == 0 && i + 1 < argc) {
+            bench.instructions = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+            bench.ipf = atoi(argv[++i]);
+        } else {
+            first_rom = i;
+            break;
+        }
+    }
+    if (bench.runs < 1 || bench.ipf < 1 || bench.instructions < bench.ipf) {
+        fprintf(stderr, "usage: %s [--runs runs] [--instructions instructions] [--ipf instructions per frame] "
+                        "[rom.ch8 ...]\n"
+                        "       %s --draw [--runs runs] [--instructions draws]\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bench.blocks = malloc(sizeof *bench.blocks);
+    bench.jit = malloc(sizeof *bench.jit);
+    if (!bench.blocks || !bench.jit) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    init_block_cache(bench.blocks);
+    if (!init_jit(bench.jit)) {
+        free(bench.jit);
+        bench.jit = NULL;
+    }
+
+    printf("benchmark,engine,instructions,skipped,runs,"
+           "mips_mean,mips_stddev,ns_per_instruction_mean,ns_per_instruction_min\n");
+    if (draw_only) {
+        return run_draw_benchmark(&bench) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof microbenches / sizeof microbenches[0]; i++) {
+        unsigned char image[64];
+        for (int j = 0; j < microbenches[i].length; j++) {
+            image[2 * j] = microbenches[i].program[j] >> 8;
+            image[2 * j + 1] = microbenches[i].program[j] & 0xFF;
+        }
+        run_all_engines(&bench, microbenches[i].name, image, 2 * (size_t)microbenches[i].length);
+    }
+
+    for (int i = first_rom; i < argc; i++) {
+        static unsigned char rom[MEMORY_SIZE - 0x200];
+        FILE *file = fopen(argv[i], "rb");
+        if (!file) {
+            fprintf(stderr, "Unable to load ROM: %s\n", argv[i]);
+            continue;
+        }
+        size_t size = fread(rom, 1, sizeof rom, file);
+        fclose(file);
+        run_all_engines(&bench, argv[i], rom, size);
+    }
+
+    if (bench.jit) {
+        destroy_jit(bench.jit);
+        free(bench.jit);
+    }
+    free(bench.blocks);
+    return EXIT_SUCCESS;
+}
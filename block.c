@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include "block.h"
+
+// Returns whether an opcode has to be the last one in a block: anything that may change pc or stop execution, and
+// the stores, so that a block overwriting code is noticed before the next block is dispatched.
+int ends_block(unsigned short opcode) {
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            return opcode == 0x00EE;
+        case 0x6000:
+        case 0x7000:
+        case 0xA000:
+        case 0xC000:
+            return 0;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0000: case 0x0001: case 0x0002: case 0x0003: case 0x0004:
+                case 0x0005: case 0x0006: case 0x0007: case 0x000E:
+                    return 0;
+            }
+            return 1;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0007: case 0x0015: case 0x0018: case 0x001E: case 0x0029: case 0x0065:
+                    return 0;
+            }
+            return 1;
+    }
+    return 1; // jumps, calls, skips, draws, key skips and anything unknown
+}
+
+// Returns the 64-byte code pages a block's instructions occupy. A block is at most 64 bytes long, so that is never
+// more than two pages.
+static unsigned long long block_pages(const Block_t *block) {
+    return (1ULL << (block->start >> 6)) | (1ULL << (((block->end - 1) & 0x0FFF) >> 6));
+}
+
+void init_block_cache(BlockCache_t *cache) {
+    cache->used = 0;
+    for (int i = 0; i < MEMORY_SIZE; i++) {
+        cache->lookup[i] = NULL;
+    }
+}
+
+void flush_block_cache(BlockCache_t *cache, Chip8_t *chip8) {
+    init_block_cache(cache);
+    chip8->code_pages[CODE_CACHE_BLOCKS] = 0;
+    chip8->written_code_pages[CODE_CACHE_BLOCKS] = 0;
+}
+
+// Drops every block living in a page that has been stored to, and unchains any exit that led to one of them.
+static void invalidate_written_blocks(BlockCache_t *cache, Chip8_t *chip8) {
+    unsigned long long written = chip8->written_code_pages[CODE_CACHE_BLOCKS];
+    chip8->written_code_pages[CODE_CACHE_BLOCKS] = 0;
+    chip8->code_pages[CODE_CACHE_BLOCKS] = 0;
+
+    for (int i = 0; i < cache->used; i++) {
+        Block_t *block = &cache->blocks[i];
+        if (!block->valid) {
+            continue;
+        }
+
+        if (block_pages(block) & written) {
+            block->valid = 0;
+            cache->lookup[block->start] = NULL;
+        } else {
+            chip8->code_pages[CODE_CACHE_BLOCKS] |= block_pages(block);
+        }
+    }
+
+    for (int i = 0; i < cache->used; i++) {
+        Block_t *block = &cache->blocks[i];
+        for (int j = 0; j < BLOCK_EXITS; j++) {
+            if (block->exit_block[j] && !block->exit_block[j]->valid) {
+                block->exit_block[j] = NULL;
+            }
+        }
+    }
+}
+
+// Decodes the straight-line run starting at start into a new block
+static Block_t *translate_block(BlockCache_t *cache, Chip8_t *chip8, unsigned short start) {
+    if (cache->used == BLOCK_CACHE_SIZE) {
+        flush_block_cache(cache, chip8);
+    }
+
+    Block_t *block = &cache->blocks[cache->used++];
+    block->start = start;
+    block->count = 0;
+    block->next_exit = 0;
+    for (int i = 0; i < BLOCK_EXITS; i++) {
+        block->exit_block[i] = NULL;
+        block->exit_pc[i] = 0;
+    }
+
+    unsigned short address = start;
+    do {
+        const Instruction_t *instruction = decode_at(chip8, address);
+        block->ops[block->count++] = *instruction;
+        address += 2;
+        if (ends_block(instruction->opcode)) {
+            break;
+        }
+    } while (block->count < BLOCK_MAX_OPS && address < MEMORY_SIZE - 1);
+
+    block->end = address;
+    block->valid = 1;
+    cache->lookup[start] = block;
+    chip8->code_pages[CODE_CACHE_BLOCKS] |= block_pages(block);
+    return block;
+}
+
+// Runs a block. Only the last instruction can move pc, so the ones before it are plain calls with no pc updates.
+static inline void execute_block(Chip8_t *chip8, const Block_t *block) {
+    const Instruction_t *last = &block->ops[block->count - 1];
+    for (const Instruction_t *op = block->ops; op < last; op++) {
+        op->handler(chip8, op);
+    }
+
+    chip8->pc = block->end & 0x0FFF;
+    chip8->opcode = last->opcode;
+    last->handler(chip8, last);
+}
+
+// Executes whole blocks until at least cycles instructions have run and returns how many did. Each block exit is
+// chained to the block it led to, so a loop that has run once goes from block to block without a lookup.
+int run_blocks(BlockCache_t *cache, Chip8_t *chip8, int cycles) {
+    int executed = 0;
+    Block_t *block = NULL;
+
+    while (executed < cycles) {
+        if (chip8->written_code_pages[CODE_CACHE_BLOCKS]) {
+            invalidate_written_blocks(cache, chip8);
+            block = NULL;
+        }
+
+        unsigned short pc = chip8->pc & 0x0FFF;
+        Block_t *next = NULL;
+        if (block) {
+            for (int i = 0; i < BLOCK_EXITS; i++) {
+                if (block->exit_pc[i] == pc && block->exit_block[i]) {
+                    next = block->exit_block[i];
+                    break;
+                }
+            }
+        }
+
+        if (!next) {
+            next = cache->lookup[pc];
+            if (!next) {
+                if (cache->used == BLOCK_CACHE_SIZE) {
+                    block = NULL; // about to be flushed along with everything else
+                }
+                next = translate_block(cache, chip8, pc);
+            }
+
+            if (block) {
+                block->exit_block[block->next_exit] = next;
+                block->exit_pc[block->next_exit] = pc;
+                block->next_exit = (block->next_exit + 1) % BLOCK_EXITS;
+            }
+        }
+
+        block = next;
+        execute_block(chip8, block);
+        executed += block->count;
+    }
+
+    return executed;
+}
@@ -0,0 +1,37 @@
+#ifndef CHIP_8_BLOCK_H
+#define CHIP_8_BLOCK_H
+#include "cpu.h"
+
+#define BLOCK_MAX_OPS 32 // longest straight-line run translated into one block
+#define BLOCK_CACHE_SIZE 1024 // blocks held before the whole cache is flushed
+#define BLOCK_EXITS 2 // chained successors remembered per block
+
+typedef struct Block Block_t;
+
+// Block_t is a straight-line run of decoded instructions ending at the first jump, call, return, skip, draw,
+// key wait or store. Only the last instruction can change pc, so the ones before it run back to back.
+struct Block {
+    unsigned short start; // address of the first instruction
+    unsigned short end; // address just past the last instruction
+    int count; // number of instructions in ops
+    int valid;
+    Instruction_t ops[BLOCK_MAX_OPS];
+    Block_t *exit_block[BLOCK_EXITS]; // successors this block has already been chained to
+    unsigned short exit_pc[BLOCK_EXITS]; // pc that leads to each chained successor
+    int next_exit; // exit slot to replace when a new successor is chained
+};
+
+// BlockCache_t holds the translated blocks of one machine. It is large, so allocate it rather than keeping it on the
+// stack, and call flush_block_cache after init_chip8 or after loading a new ROM.
+typedef struct {
+    Block_t blocks[BLOCK_CACHE_SIZE];
+    Block_t *lookup[MEMORY_SIZE]; // block starting at each address, if one has been translated
+    int used;
+} BlockCache_t;
+
+int ends_block(unsigned short opcode);
+void init_block_cache(BlockCache_t *cache);
+void flush_block_cache(BlockCache_t *cache, Chip8_t *chip8);
+int run_blocks(BlockCache_t *cache, Chip8_t *chip8, int cycles);
+
+#endif //CHIP_8_BLOCK_H
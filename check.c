@@ -0,0 +1,513 @@
+// chip8-check: differential test of every engine against emulate_cycle, the reference interpreter.
+//
+//   chip8-check [--seeds seeds]
+//
+// Each seed fills memory from 0x200 up with random valid opcodes and picks random registers and keys; half of them
+// start with a loop waiting on the delay timer, so that run_cycles has a wait loop to skip through. The program is
+// then run on each engine (run_cycles with its wait loop skipping, run_threaded, run_blocks and, where the host
+// supports it, run_jit, then all of them taking turns on one machine) in slices of random length, ticking the timers
+// now and then. After every slice a copy of the machine runs as many instructions through emulate_cycle as the
+// engine says it executed, and the two must agree on memory, V, I, pc, sp, the stack, the screen, the timers, Cxkk's
+// random state, the last opcode and the count of unknown opcodes run, which stores overwriting code with anything
+// make common. The first mismatch is printed and fails the run; the whole report goes to stderr.
+//
+// run_lockstep is checked the same way on every LOCKSTEP_SEED_STEPth seed's program, in all LOCKSTEP_LANES lanes at
+// once, each lane with its own keys, Cxkk seed and one register changed so that lanes branch apart and come back
+// together; every lane is compared with a machine of its own run through emulate_cycle.
+//
+// Each seed's program is also saved part way through with save_state, loaded into a fresh machine and run on beside
+// the original; load_state must refuse the state cut short, with a byte added, with its magic or version changed or
+// with a zero random state, and leave the machine it was given alone.
+//
+// Every REWIND_SEED_STEPth seed's program is recorded into a small rewind buffer for long enough to wrap it several
+// times, with random rewinds along the way; each must bring back exactly the machine snapshotted when that frame was
+// recorded. These programs store with Fx33 and Fx55 every few instructions, and after every frame the buffer's
+// page-tracked image must match a capture of all of memory, so that a store path that skips the page counts fails.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "block.h"
+#include "jit.h"
+#include "lockstep.h"
+#include "savestate.h"
+#include "rewind.h"
+
+#define DEFAULT_SEEDS 400
+#define SLICES 200 // per seed and engine
+#define MAX_SLICE 40 // instructions asked for in one slice
+#define LOCKSTEP_SEED_STEP 4 // each lockstep seed is LOCKSTEP_LANES machines, and lanes that scatter run slowly
+#define REWIND_SEED_STEP 4 // each rewind seed records REWIND_FRAMES frames
+#define REWIND_FRAMES 3000 // recorded per rewind seed, enough to wrap a REWIND_MIN_BYTES buffer several times
+#define REWIND_PERIOD 512 // frames between rewinds on average
+#define REWIND_STORE_SPACING 8 // one instruction in this many of a rewind seed's program is an Fx33 or Fx55
+#define REWIND_WRAPS 2 // the fewest times a rewind seed's buffer must wrap for the seed to count
+#define TRUNCATIONS 8 // random truncated lengths tried on each seed's save state, besides the edges of the header
+
+typedef enum {
+    ENGINE_CYCLES,
+    ENGINE_THREADED,
+    ENGINE_BLOCKS,
+    ENGINE_JIT,
+    ENGINE_MIXED, // a random one of the above for each slice, all on the same machine
+    ENGINE_COUNT
+} Engine_t;
+
+static const char *const engine_names[ENGINE_COUNT] = {"cycles", "threaded", "blocks", "jit", "mixed"};
+
+// Check_t is a struct that contains the machines under test and the engines' state
+typedef struct {
+    Chip8_t reference;
+    Chip8_t machine;
+    BlockCache_t *blocks;
+    Jit_t *jit; // NULL when this host can't run the JIT
+    Lockstep_t *lockstep;
+    Chip8_t lanes[LOCKSTEP_LANES]; // a reference machine per lane
+    RewindImage_t history[REWIND_FRAMES]; // the machine as each frame was recorded, along the current timeline
+    uint32_t random; // xorshift32 state for generating programs and slices
+} Check_t;
+
+static uint32_t next_random(Check_t *check) {
+    check->random ^= check->random << 13;
+    check->random ^= check->random >> 17;
+    check->random ^= check->random << 5;
+    return check->random;
+}
+
+// A random opcode that decodes to a real instruction
+static unsigned short random_opcode(Check_t *check) {
+    static const unsigned char f_opcodes[] = {0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65};
+    for (;;) {
+        unsigned short opcode = next_random(check) & 0xFFFF;
+        switch (opcode >> 12) {
+            case 0x0: return next_random(check) % 2 ? 0x00E0 : 0x00EE;
+            case 0x5:
+            case 0x9: return opcode & 0xFFF0;
+            case 0x8: {
+                int n = opcode & 0x000F;
+                if (n <= 0x7 || n == 0xE) {
+                    return opcode;
+                }
+            } break;
+            case 0xE: return (opcode & 0xFF00) | (next_random(check) % 2 ? 0x9E : 0xA1);
+            case 0xF: return (opcode & 0xFF00) | f_opcodes[next_random(check) % sizeof f_opcodes];
+            default: return opcode;
+        }
+    }
+}
+
+static void make_program(Check_t *check, Chip8_t *chip8) {
+    init_chip8(chip8);
+    for (int address = 0x200; address < MEMORY_SIZE; address += 2) {
+        unsigned short opcode = random_opcode(check);
+        chip8->memory[address] = opcode >> 8;
+        chip8->memory[address + 1] = opcode & 0xFF;
+    }
+    for (int i = 0; i < REGISTER_SIZE; i++) {
+        chip8->V[i] = next_random(check) & 0xFF;
+    }
+    for (int k = 0; k < 16; k++) {
+        chip8->keypad[k] = next_random(check) % 3 == 0;
+    }
+    seed_random(chip8, next_random(check) | 1);
+
+    if (next_random(check) % 2) {
+        static const unsigned char wait_loop[] = {
+            0x60, 0x00, // 6000: V0 = ticks to wait, set below
+            0xF0, 0x15, // F015: DT = V0
+            0xF0, 0x07, // F007: V0 = DT
+            0x30, 0x00, // 3000: skip the jump once DT reaches 0
+            0x12, 0x04, // 1204: back to F007
+        };
+        memcpy(&chip8->memory[0x200], wait_loop, sizeof wait_loop);
+        chip8->memory[0x201] = 1 + next_random(check) % 8;
+    }
+    flush_decode_cache(chip8);
+}
+
+// Returns the name of the first part of the machine that differs, or NULL if they agree
+static const char *compare_machines(const Chip8_t *a, const Chip8_t *b) {
+    if (memcmp(a->memory, b->memory, MEMORY_SIZE) != 0) return "memory";
+    if (memcmp(a->V, b->V, REGISTER_SIZE) != 0) return "V";
+    if (a->I != b->I) return "I";
+    if ((a->pc & 0x0FFF) != (b->pc & 0x0FFF)) return "pc";
+    if (a->sp != b->sp) return "sp";
+    if (memcmp(a->stack, b->stack, sizeof a->stack) != 0) return "stack";
+    if (memcmp(a->gfx, b->gfx, sizeof a->gfx) != 0) return "gfx";
+    if (a->delay_timer != b->delay_timer || a->sound_timer != b->sound_timer) return "timers";
+    if (a->random_state != b->random_state) return "random_state";
+    if (a->opcode != b->opcode) return "opcode";
+    if (a->unknown_opcodes != b->unknown_opcodes || a->last_unknown != b->last_unknown) return "unknown opcodes";
+    return NULL;
+}
+
+// Runs one slice on the engine and returns how many instructions it executed
+static int run_slice(Check_t *check, Engine_t engine, int cycles) {
+    Chip8_t *chip8 = &check->machine;
+    if (engine == ENGINE_MIXED) {
+        engine = (Engine_t)(next_random(check) % (check->jit ? ENGINE_JIT + 1 : ENGINE_JIT));
+    }
+    switch (engine) {
+        case ENGINE_CYCLES: return run_cycles(chip8, cycles).cycles;
+        case ENGINE_THREADED: return run_threaded(chip8, cycles);
+        case ENGINE_BLOCKS: return run_blocks(check->blocks, chip8, cycles);
+        case ENGINE_JIT: return run_jit(check->jit, chip8, cycles);
+        default: return 0;
+    }
+}
+
+// Runs one seed's program on one engine against the reference; returns 0 and says where on a mismatch. Adds the
+// instructions run_cycles skipped in wait loops to skipped.
+static int check_engine(Check_t *check, uint32_t seed, Engine_t engine, unsigned long long *skipped) {
+    check->random = seed * 2654435761u + 1;
+    make_program(check, &check->reference);
+    check->machine = check->reference;
+    flush_block_cache(check->blocks, &check->machine);
+    if (check->jit) {
+        flush_jit(check->jit, &check->machine);
+    }
+
+    for (int slice = 0; slice < SLICES; slice++) {
+        int executed = run_slice(check, engine, 1 + (int)(next_random(check) % MAX_SLICE));
+        for (int i = 0; i < executed; i++) {
+            emulate_cycle(&check->reference);
+        }
+        if (next_random(check) % 4 == 0) {
+            tick_timers(&check->reference);
+            tick_timers(&check->machine);
+        }
+
+        const char *difference = compare_machines(&check->reference, &check->machine);
+        if (difference) {
+            fprintf(stderr, "seed %u, engine %s, slice %d: %s differs (reference pc %03X, engine pc %03X)\n", seed,
+                    engine_names[engine], slice, difference, check->reference.pc, check->machine.pc);
+            return 0;
+        }
+    }
+    *skipped += check->machine.idle_cycles;
+    return 1;
+}
+
+// compare_machines for a lane, read in place: get_lane would flush a decode cache for every comparison
+static const char *compare_lane(const Chip8_t *a, const Lockstep_t *lockstep, int lane) {
+    if (memcmp(a->memory, lockstep->memory[lane], MEMORY_SIZE) != 0) return "memory";
+    for (int r = 0; r < REGISTER_SIZE; r++) {
+        if (a->V[r] != lockstep->V[r][lane]) return "V";
+    }
+    if (a->I != lockstep->I[lane]) return "I";
+    if ((a->pc & 0x0FFF) != lockstep->pc[lane]) return "pc";
+    if (a->sp != lockstep->sp[lane]) return "sp";
+    for (int s = 0; s < STACK_SIZE; s++) {
+        if (a->stack[s] != lockstep->stack[s][lane]) return "stack";
+    }
+    if (memcmp(a->gfx, lockstep->gfx[lane], sizeof a->gfx) != 0) return "gfx";
+    if (a->delay_timer != lockstep->delay_timer[lane] || a->sound_timer != lockstep->sound_timer[lane]) return "timers";
+    if (a->random_state != lockstep->random_state[lane]) return "random_state";
+    return NULL;
+}
+
+// Runs one seed's program in every lane of the lockstep engine against a reference machine per lane; returns 0 and
+// says where on a mismatch
+static int check_lockstep(Check_t *check, uint32_t seed) {
+    check->random = seed * 2654435761u + 1;
+    make_program(check, &check->reference);
+    init_lockstep(check->lockstep, 0);
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        Chip8_t *chip8 = &check->lanes[lane];
+        *chip8 = check->reference;
+        for (int k = 0; k < 16; k++) {
+            chip8->keypad[k] = next_random(check) % 3 == 0;
+        }
+        seed_random(chip8, next_random(check) | 1);
+        chip8->V[next_random(check) % REGISTER_SIZE] = next_random(check) & 0xFF;
+        set_lane(check->lockstep, lane, chip8);
+    }
+
+    for (int slice = 0; slice < SLICES; slice++) {
+        int cycles = 1 + (int)(next_random(check) % MAX_SLICE);
+        int tick = next_random(check) % 4 == 0;
+        run_lockstep(check->lockstep, cycles);
+        if (tick) {
+            tick_lockstep_timers(check->lockstep);
+        }
+
+        for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            Chip8_t *chip8 = &check->lanes[lane];
+            for (int i = 0; i < cycles; i++) {
+                emulate_cycle(chip8);
+            }
+            if (tick) {
+                tick_timers(chip8);
+            }
+
+            const char *difference = compare_lane(chip8, check->lockstep, lane);
+            if (difference) {
+                fprintf(stderr, "seed %u, engine lockstep, slice %d, lane %d: %s differs (reference pc %03X, lane pc "
+                                "%03X)\n", seed, slice, lane, difference, chip8->pc, check->lockstep->pc[lane]);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Loads a state that must be rejected into the machine, which must come out as it was; returns 0 if it doesn't
+static int rejects(Check_t *check, const unsigned char *buffer, size_t size) {
+    Chip8_t *chip8 = &check->machine;
+    unsigned char keypad[16];
+    memcpy(keypad, chip8->keypad, sizeof keypad);
+    return !load_state(chip8, buffer, size) && !compare_machines(chip8, &check->reference) &&
+           memcmp(keypad, chip8->keypad, sizeof keypad) == 0;
+}
+
+// Saves one seed's program part way through, loads it into a fresh machine and runs both on; then checks that
+// load_state refuses truncated, overlong, bad-magic, bad-version and zero-random-state buffers without touching the
+// machine. Returns 0 and says where on a failure.
+static int check_savestate(Check_t *check, uint32_t seed) {
+    static unsigned char buffer[SAVESTATE_MAX_SIZE + 1];
+    check->random = seed * 2654435761u + 1;
+    make_program(check, &check->reference);
+    Chip8_t *reference = &check->reference, *chip8 = &check->machine;
+    for (int slice = 0; slice < SLICES; slice++) {
+        for (int i = 1 + (int)(next_random(check) % MAX_SLICE); i > 0; i--) {
+            emulate_cycle(reference);
+        }
+        if (next_random(check) % 4 == 0) {
+            tick_timers(reference);
+        }
+    }
+
+    size_t size = save_state(reference, buffer, SAVESTATE_MAX_SIZE);
+    if (size == 0 || save_state(reference, buffer, size - 1) != 0 || save_state(reference, buffer, size) != size) {
+        fprintf(stderr, "seed %u, savestate: save_state wrote %zu bytes, or took a buffer too small\n", seed, size);
+        return 0;
+    }
+    init_chip8(chip8);
+    const char *difference = load_state(chip8, buffer, size) ? NULL : "load_state failed";
+    if (!difference && memcmp(chip8->keypad, reference->keypad, sizeof chip8->keypad) != 0) {
+        difference = "keypad";
+    }
+//    the last opcode and unknown opcode count aren't part of a state; run both on so that the loaded machine's
+//    rebuilt caches are used
+    chip8->opcode = reference->opcode;
+    chip8->unknown_opcodes = reference->unknown_opcodes;
+    chip8->last_unknown = reference->last_unknown;
+    for (int slice = 0; slice < SLICES && !difference; slice++) {
+        for (int i = 1 + (int)(next_random(check) % MAX_SLICE); i > 0; i--) {
+            emulate_cycle(reference);
+            emulate_cycle(chip8);
+        }
+        difference = compare_machines(reference, chip8);
+    }
+    if (difference) {
+        fprintf(stderr, "seed %u, savestate: %s differs after loading\n", seed, difference);
+        return 0;
+    }
+
+    size = save_state(reference, buffer, SAVESTATE_MAX_SIZE);
+    const char *accepted = NULL;
+    for (int i = 0; i < TRUNCATIONS + 3 && !accepted; i++) {
+        size_t length = i == 0 ? 0 : i == 1 ? 4 : i == 2 ? size - 1 : next_random(check) % size;
+        if (!rejects(check, buffer, length)) accepted = "a truncated state";
+    }
+    buffer[size] = 0;
+    if (!accepted && !rejects(check, buffer, size + 1)) accepted = "a state with a byte after it";
+
+    int magic = next_random(check) % 4;
+    buffer[magic] ^= 0x20;
+    if (!accepted && !rejects(check, buffer, size)) accepted = "bad magic";
+    buffer[magic] ^= 0x20;
+    buffer[4] = SAVESTATE_VERSION + 1;
+    if (!accepted && !rejects(check, buffer, size)) accepted = "a bad version";
+    buffer[4] = SAVESTATE_VERSION;
+
+    uint32_t random_state = reference->random_state;
+    reference->random_state = 0;
+    size_t zero_size = save_state(reference, buffer, SAVESTATE_MAX_SIZE);
+    reference->random_state = random_state;
+    if (!accepted && !rejects(check, buffer, zero_size)) accepted = "a zero random state";
+
+    if (accepted) {
+        fprintf(stderr, "seed %u, savestate: load_state accepted %s, or changed the machine\n", seed, accepted);
+        return 0;
+    }
+    return 1;
+}
+
+// The whole machine as a RewindImage_t, every page copied
+static void snapshot(const Chip8_t *chip8, RewindImage_t *image) {
+    memset(image, 0, sizeof *image);
+    memcpy(image->memory, chip8->memory, MEMORY_SIZE);
+    memcpy(image->gfx, chip8->gfx, sizeof image->gfx);
+    image->random_state = chip8->random_state;
+    memcpy(image->stack, chip8->stack, sizeof image->stack);
+    image->I = chip8->I;
+    image->pc = chip8->pc;
+    memcpy(image->V, chip8->V, REGISTER_SIZE);
+    memcpy(image->keypad, chip8->keypad, sizeof image->keypad);
+    image->sp = chip8->sp;
+    image->delay_timer = chip8->delay_timer;
+    image->sound_timer = chip8->sound_timer;
+}
+
+// Records REWIND_FRAMES frames of one seed's program, made heavy in Fx33 and Fx55 and run by random engines, into a
+// REWIND_MIN_BYTES buffer, now and then rewinding a random number of frames and carrying on from there. The buffer's
+// newest image, kept up to date page by page, must match a full snapshot after every frame, and every rewind must
+// restore the machine exactly as it was snapshotted when that frame was recorded. Returns 0 and says where on a
+// mismatch; adds the times the buffer wrapped to wraps.
+static int check_rewind(Check_t *check, uint32_t seed, unsigned long long *wraps) {
+    check->random = seed * 2654435761u + 1;
+    Chip8_t *chip8 = &check->machine;
+    make_program(check, chip8);
+//    stores much more often than at random, so that pages change under the buffer's page tracking all the time
+    for (int address = 0x20A; address < MEMORY_SIZE; address += 2) {
+        if (next_random(check) % REWIND_STORE_SPACING == 0) {
+            chip8->memory[address] = 0xF0 | (next_random(check) & 0x0F);
+            chip8->memory[address + 1] = next_random(check) % 2 ? 0x33 : 0x55;
+        }
+    }
+    flush_decode_cache(chip8);
+    flush_block_cache(check->blocks, chip8);
+    if (check->jit) {
+        flush_jit(check->jit, chip8);
+    }
+    Rewind_t rewind;
+    if (!init_rewind(&rewind, REWIND_MIN_BYTES)) {
+        fprintf(stderr, "Out of memory\n");
+        return 0;
+    }
+
+    const char *failure = NULL;
+    int frames = 0, wrapped = 0, depth = 0;
+    for (int step = 0; step < REWIND_FRAMES && !failure; step++) {
+        run_slice(check, ENGINE_MIXED, 1 + (int)(next_random(check) % MAX_SLICE));
+        tick_timers(chip8);
+        size_t head = rewind.head;
+        record_frame(&rewind, chip8);
+        wrapped += rewind.head < head;
+        snapshot(chip8, &check->history[frames++]);
+//        last copied only the pages dirty_pages reported, so a store that goes around store_memory leaves it stale
+        if (memcmp(&rewind.last, &check->history[frames - 1], sizeof rewind.last) != 0) {
+            failure = "the page-tracked image differs from a full capture";
+            break;
+        }
+
+        if (next_random(check) % REWIND_PERIOD == 0 || step == REWIND_FRAMES - 1) {
+//            half the rewinds, and the last, go to the oldest frame left, which wrapping and dropping frames touch
+            depth = rewind_depth(&rewind);
+            int oldest = step == REWIND_FRAMES - 1 || next_random(check) % 2;
+            int back = oldest ? depth - 1 : (int)(next_random(check) % depth);
+            RewindImage_t restored;
+            if (depth > frames || !rewind_frames(&rewind, back, chip8)) {
+                failure = "rewind_frames refused a depth it holds";
+                break;
+            }
+            frames -= back;
+            snapshot(chip8, &restored);
+            if (memcmp(&restored, &check->history[frames - 1], sizeof restored) != 0) {
+                failure = "the machine differs from the frame's snapshot";
+            } else if (rewind_frames(&rewind, rewind_depth(&rewind), chip8) || rewind_frames(&rewind, -1, chip8)) {
+                failure = "rewind_frames accepted a depth it doesn't hold";
+            }
+        }
+    }
+    depth = rewind_depth(&rewind);
+    destroy_rewind(&rewind);
+    *wraps += wrapped;
+
+    if (!failure && wrapped < REWIND_WRAPS) {
+        failure = "the buffer didn't wrap often enough";
+    }
+    if (failure) {
+        fprintf(stderr, "seed %u, rewind, frame %d of a buffer %d deep, wrapped %d times: %s\n", seed,
+                frames, depth, wrapped, failure);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    int seeds = DEFAULT_SEEDS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seeds") == 0 && i + 1 < argc) {
+            seeds = atoi(argv[++i]);
+        } else {
+            seeds = -1;
+        }
+    }
+    if (seeds < 1) {
+        fprintf(stderr, "usage: %s [--seeds seeds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    static Check_t check;
+    check.blocks = malloc(sizeof *check.blocks);
+    check.jit = malloc(sizeof *check.jit);
+    check.lockstep = malloc(sizeof *check.lockstep);
+    if (!check.blocks || !check.jit || !check.lockstep) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    init_block_cache(check.blocks);
+    if (!init_jit(check.jit)) {
+        free(check.jit);
+        check.jit = NULL;
+    }
+
+    int failures = 0;
+    for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+        if (engine == ENGINE_JIT && !check.jit) {
+            fprintf(stderr, "jit: unavailable on this host, skipped\n");
+            continue;
+        }
+        int passed = 0;
+        unsigned long long skipped = 0;
+        for (int seed = 0; seed < seeds; seed++) {
+            passed += check_engine(&check, (uint32_t)seed, engine, &skipped);
+        }
+        fprintf(stderr, "%s: %d/%d seeds match emulate_cycle", engine_names[engine], passed, seeds);
+        if (skipped) {
+            fprintf(stderr, ", %llu instructions skipped in wait loops", skipped);
+        }
+        fprintf(stderr, "\n");
+        failures += seeds - passed;
+    }
+
+    int passed = 0, run = 0;
+    unsigned long long lane_steps = 0, groups = 0;
+    for (int seed = 0; seed < seeds; seed += LOCKSTEP_SEED_STEP) {
+        passed += check_lockstep(&check, (uint32_t)seed);
+        lane_steps += check.lockstep->lane_steps;
+        groups += check.lockstep->groups;
+        run++;
+    }
+    fprintf(stderr, "lockstep: %d/%d seeds match emulate_cycle in all %d lanes, %.1f lanes per dispatch\n", passed,
+            run, LOCKSTEP_LANES, groups ? (double)lane_steps / (double)groups : 0.0);
+    failures += run - passed;
+
+    passed = 0;
+    for (int seed = 0; seed < seeds; seed++) {
+        passed += check_savestate(&check, (uint32_t)seed);
+    }
+    fprintf(stderr, "savestate: %d/%d seeds load back and run on in step; truncated, overlong, bad-magic, "
+                    "bad-version and zero-random-state states are rejected\n", passed, seeds);
+    failures += seeds - passed;
+
+    passed = 0, run = 0;
+    unsigned long long wraps = 0;
+    for (int seed = 0; seed < seeds; seed += REWIND_SEED_STEP) {
+        passed += check_rewind(&check, (uint32_t)seed, &wraps);
+        run++;
+    }
+    fprintf(stderr, "rewind: %d/%d seeds track every stored page and restore every rewound frame exactly, the buffer "
+                    "wrapping %.1f times a seed\n", passed, run, (double)wraps / run);
+    failures += run - passed;
+
+    if (check.jit) {
+        destroy_jit(check.jit);
+        free(check.jit);
+    }
+    free(check.blocks);
+    free(check.lockstep);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
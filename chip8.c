@@ -1,13 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "SDL.h"
-#include "fontset.h"
-#include "cpu.c"
+#include "cpu.h"
+#include "jit.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "frame.h"
+#include "scheduler.h"
 
-// SDL_t is a struct that contains the SDL window and renderer
+#define DEFAULT_REWIND_MEGABYTES 16 // twenty minutes to three hours of history, depending on the ROM
+
+// SDL_t is a struct that contains the SDL window, renderer and the texture the screen is drawn into
 typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *screen; // SCREEN_WIDTH x SCREEN_HEIGHT, scaled to the window when copied
 } SDL_t;
 
 // DisplayConfig_t is a struct that contains the display configuration
@@ -17,6 +25,42 @@ typedef struct {
     int window_scale;
 } DisplayConfig_t;
 
+// FrameStats_t is a struct that contains the frame timings printed on exit. The emulation thread writes the frame
+// counts and timings, the SDL thread the screen updates.
+typedef struct {
+    Uint64 frames;
+    Uint64 screen_updates; // frames the SDL thread received and uploaded to the texture
+    Uint64 rows_uploaded;
+    Uint64 total_ticks; // time spent emulating, in performance counter ticks
+    Uint64 worst_ticks;
+} FrameStats_t;
+
+// StateRequest_t is a save state operation asked for by the SDL thread and carried out by the emulation thread
+typedef enum {
+    STATE_NONE,
+    STATE_SAVE, // F5
+    STATE_LOAD, // F9
+} StateRequest_t;
+
+// Emulator_t is a struct that contains what the emulation thread shares with the SDL thread. The machine and JIT
+// belong to the emulation thread once it has started; everything else crosses threads through the atomics.
+typedef struct {
+    Chip8_t *chip8;
+    Jit_t *jit;
+    Rewind_t *rewind; // NULL when rewinding is off
+    int cycles_per_frame;
+    Scheduler_t scheduler;
+    FrameExchange_t frames; // screens going to the SDL thread
+    atomic_uint keys; // keypad state coming from the SDL thread, bit k set while key k is held
+    atomic_int running;
+    atomic_int state_request; // a StateRequest_t, done between two frames
+    atomic_int rewinding; // set while Backspace is held
+    char state_path[1024]; // the ROM's path with .state appended
+    Uint32 frame_event; // SDL user event pushed to wake the SDL thread when a frame is published
+    atomic_int frame_event_pending; // set while one is queued, so a stalled SDL thread doesn't fill its queue
+    FrameStats_t *stats;
+} Emulator_t;
+
 
 
 void init_display(DisplayConfig_t *displayConfig){
@@ -69,21 +113,261 @@ int init_sdl (SDL_t *sdl,DisplayConfig_t *displayConfig){
         return 0;
     }
 
+//    create screen texture; the renderer scales it up to the window, so it only ever holds 64x32 pixels
+    sdl -> screen = SDL_CreateTexture(
+        sdl -> renderer,
+        SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING,
+        SCREEN_WIDTH,
+        SCREEN_HEIGHT
+    );
+
+//    check if texture was created
+    if (!(sdl -> screen)) {
+        SDL_Log(
+            "Unable to create SDL Texture: %s\n",
+            SDL_GetError()
+        );
+        return 0;
+    }
+
     return 1;
 }
 
+// Uploads the rows of a new frame that differ from what the texture already shows, one sub-rect per run of changed
+// rows, then presents it with a single scaled copy. Comparing against the shown rows, rather than using the frame's
+// dirty_rows, stays correct when the emulation thread published frames the SDL thread never took. Without a new frame
+// (e.g. after the window was exposed) the texture is just presented again.
+void update_screen(SDL_t *sdl, const Frame_t *frame, uint64_t shown[SCREEN_HEIGHT], FrameStats_t *stats) {
+    if (frame) {
+        static Uint32 pixels[SCREEN_HEIGHT][SCREEN_WIDTH];
+        int y = 0;
+        while (y < SCREEN_HEIGHT) {
+            if (frame->gfx[y] == shown[y]) {
+                y++;
+                continue;
+            }
+
+//            convert the whole run of consecutive changed rows, then upload it in one go
+            int first = y;
+            for (; y < SCREEN_HEIGHT && frame->gfx[y] != shown[y]; y++) {
+                uint64_t row = frame->gfx[y];
+                for (int x = 0; x < SCREEN_WIDTH; x++) {
+                    pixels[y][x] = (row >> (63 - x)) & 1 ? 0xFFFFFFFF : 0xFF000000; // white on black
+                }
+                shown[y] = row;
+            }
+            SDL_Rect rows = {0, first, SCREEN_WIDTH, y - first};
+            SDL_UpdateTexture(sdl->screen, &rows, pixels[first], sizeof pixels[0]);
+            stats->rows_uploaded += y - first;
+        }
+        stats->screen_updates++;
+    }
+
+    SDL_RenderCopy(sdl->renderer, sdl->screen, NULL, NULL);
+    SDL_RenderPresent(sdl->renderer);
+}
+
+// Fills the screen texture with black, matching shown being all zero
+void clear_screen(SDL_t *sdl) {
+    static const Uint32 black[SCREEN_HEIGHT][SCREEN_WIDTH] = {{0}};
+    SDL_UpdateTexture(sdl->screen, NULL, black, sizeof black[0]);
+}
+
+// Runs one 60 Hz frame: cycles instructions, then one tick of each timer
+void emulate_frame(Chip8_t *chip8, Jit_t *jit, int cycles) {
+    if (jit) {
+        run_jit(jit, chip8, cycles);
+        tick_timers(chip8);
+    } else {
+        run_frame(chip8, cycles);
+    }
+}
+
+// Emulates frames at FRAME_RATE until running is cleared, publishing the screen whenever a frame changed it. Nothing
+// here waits on the SDL thread, so a slow present or vsync stall there can't delay emulation.
+int emulation_thread(void *data) {
+    Emulator_t *emulator = data;
+    Chip8_t *chip8 = emulator->chip8;
+    FrameStats_t *stats = emulator->stats;
+    init_scheduler(&emulator->scheduler);
+    unsigned long long unknown_opcodes = chip8->unknown_opcodes;
+
+    while (atomic_load_explicit(&emulator->running, memory_order_relaxed)) {
+        Uint64 frame_start = SDL_GetPerformanceCounter();
+
+        StateRequest_t request = atomic_exchange(&emulator->state_request, STATE_NONE);
+        if (request == STATE_SAVE && !save_state_file(chip8, emulator->state_path)) {
+            SDL_Log("Unable to save state: %s\n", emulator->state_path);
+        } else if (request == STATE_LOAD) {
+            if (!load_state_file(chip8, emulator->state_path)) {
+                SDL_Log("Unable to load state: %s\n", emulator->state_path);
+            } else if (emulator->jit) {
+                flush_jit(emulator->jit, chip8);
+            }
+        }
+
+        unsigned int keys = atomic_load_explicit(&emulator->keys, memory_order_relaxed);
+        for (int i = 0; i < 16; i++) {
+            chip8->keypad[i] = keys >> i & 1;
+        }
+
+//        while rewinding, each frame steps back through the recorded ones instead of emulating a new one
+        Rewind_t *rewind = emulator->rewind;
+        if (rewind && atomic_load_explicit(&emulator->rewinding, memory_order_relaxed)) {
+            if (rewind_frames(rewind, 1, chip8) && emulator->jit) {
+                flush_jit(emulator->jit, chip8);
+            }
+        } else {
+            emulate_frame(chip8, emulator->jit, emulator->cycles_per_frame);
+            if (rewind) {
+                record_frame(rewind, chip8);
+            }
+        }
+        stats->frames++;
+        if (chip8->unknown_opcodes != unknown_opcodes) {
+            SDL_Log("Unknown opcode: 0x%X\n", chip8->last_unknown);
+            unknown_opcodes = chip8->unknown_opcodes;
+        }
+
+        if (chip8->dirty_rows) {
+            Frame_t *frame = back_frame(&emulator->frames);
+            for (int y = 0; y < SCREEN_HEIGHT; y++) {
+                frame->gfx[y] = chip8->gfx[y];
+            }
+            frame->number = stats->frames;
+            publish_frame(&emulator->frames);
+            chip8->dirty_rows = 0;
+            chip8->draw_flag = 0;
+
+            if (!atomic_exchange(&emulator->frame_event_pending, 1)) {
+                SDL_Event event = {0};
+                event.type = emulator->frame_event;
+                SDL_PushEvent(&event);
+            }
+        }
+
+        Uint64 frame_ticks = SDL_GetPerformanceCounter() - frame_start;
+        stats->total_ticks += frame_ticks;
+        if (frame_ticks > stats->worst_ticks) {
+            stats->worst_ticks = frame_ticks;
+        }
+
+        wait_next_frame(&emulator->scheduler);
+    }
+
+    destroy_scheduler(&emulator->scheduler);
+    return 0;
+}
+
+void print_frame_stats(const FrameStats_t *stats) {
+    if (!stats->frames) {
+        return;
+    }
+
+    double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    printf(
+        "%llu frames, %llu screen updates (%llu rows), %.3f ms average frame time, %.3f ms worst\n",
+        (unsigned long long)stats->frames,
+        (unsigned long long)stats->screen_updates,
+        (unsigned long long)stats->rows_uploaded,
+        (double)stats->total_ticks / (double)stats->frames * ms_per_tick,
+        (double)stats->worst_ticks * ms_per_tick
+    );
+}
+
+// Maps a key on the left of a QWERTY keyboard to the chip8 keypad (1234/QWER/ASDF/ZXCV), or -1
+int keypad_index(SDL_Keycode key) {
+    switch (key) {
+        case SDLK_1: return 0x1;
+        case SDLK_2: return 0x2;
+        case SDLK_3: return 0x3;
+        case SDLK_4: return 0xC;
+        case SDLK_q: return 0x4;
+        case SDLK_w: return 0x5;
+        case SDLK_e: return 0x6;
+        case SDLK_r: return 0xD;
+        case SDLK_a: return 0x7;
+        case SDLK_s: return 0x8;
+        case SDLK_d: return 0x9;
+        case SDLK_f: return 0xE;
+        case SDLK_z: return 0xA;
+        case SDLK_x: return 0x0;
+        case SDLK_c: return 0xB;
+        case SDLK_v: return 0xF;
+        default: return -1;
+    }
+}
+
+
+// Applies one SDL event: quitting, keypad changes, save state and rewind keys and window exposure (which sets
+// force_redraw)
+void handle_event(Emulator_t *emulator, const SDL_Event *event, int *force_redraw) {
+    switch (event->type) {
+        case SDL_QUIT: {
+            atomic_store(&emulator->running, 0);
+        } break;
+        case SDL_KEYDOWN:
+        case SDL_KEYUP: {
+            SDL_Keycode symbol = event->key.keysym.sym;
+            if (event->type == SDL_KEYDOWN && !event->key.repeat && (symbol == SDLK_F5 || symbol == SDLK_F9)) {
+                atomic_store(&emulator->state_request, symbol == SDLK_F5 ? STATE_SAVE : STATE_LOAD);
+            }
+            if (symbol == SDLK_BACKSPACE) {
+                atomic_store(&emulator->rewinding, event->type == SDL_KEYDOWN);
+            }
+
+            int key = keypad_index(symbol);
+            if (key >= 0 && event->type == SDL_KEYDOWN) {
+                atomic_fetch_or_explicit(&emulator->keys, 1u << key, memory_order_relaxed);
+            } else if (key >= 0) {
+                atomic_fetch_and_explicit(&emulator->keys, ~(1u << key), memory_order_relaxed);
+            }
+        } break;
+        case SDL_WINDOWEVENT: {
+            *force_redraw |= event->window.event == SDL_WINDOWEVENT_EXPOSED;
+        } break;
+        default: {
+            if (event->type == emulator->frame_event) {
+                atomic_store(&emulator->frame_event_pending, 0);
+            }
+        } break;
+    }
+}
 
 void destroy_sdl(SDL_t *sdl){
-    SDL_DestroyWindow(sdl->window);
+    SDL_DestroyTexture(sdl->screen);
     SDL_DestroyRenderer(sdl->renderer);
+    SDL_DestroyWindow(sdl->window);
     puts("SDL Environment Destroyed");
     SDL_Quit();
 }
 
 
 int main (int argc, char **argv) {
-    (void)argc;
-    (void)argv;
+//    chip8 [--jit] [--ipf instructions per frame] [--rewind megabytes] rom.ch8
+//
+//    F5 saves the machine to rom.ch8.state and F9 loads it. Holding Backspace plays the last frames backwards, as
+//    many as fit in --rewind megabytes of history (0 turns it off).
+    const char *rom_path = NULL;
+    int use_jit = 0;
+    int cycles_per_frame = CYCLES_PER_FRAME;
+    int rewind_megabytes = DEFAULT_REWIND_MEGABYTES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            use_jit = 1;
+        } else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+            cycles_per_frame = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            rewind_megabytes = atoi(argv[++i]);
+        } else {
+            rom_path = argv[i];
+        }
+    }
+    if (!rom_path || cycles_per_frame < 1 || rewind_megabytes < 0) {
+        fprintf(stderr, "usage: %s [--jit] [--ipf instructions per frame] [--rewind megabytes] rom.ch8\n", argv[0]);
+        return EXIT_FAILURE;
+    }
 
     // initialise chip8
     DisplayConfig_t  displayConfig = {0};
@@ -96,23 +380,104 @@ int main (int argc, char **argv) {
     }
 
     // initialise chip8
-    Chip8_t chip8 = {0};
+    static Chip8_t chip8;
     init_chip8(&chip8);
+    if (!load_rom(&chip8, rom_path)) {
+        SDL_Log("Unable to load ROM: %s\n", rom_path);
+        destroy_sdl(&sdl);
+        return EXIT_FAILURE;
+    }
+
+    // initialise jit, falling back to the interpreter when this host can't run it
+    Jit_t *jit = NULL;
+    if (use_jit) {
+        jit = malloc(sizeof *jit);
+        if (jit && init_jit(jit)) {
+            flush_jit(jit, &chip8);
+        } else {
+            SDL_Log("JIT unavailable, using the interpreter\n");
+            free(jit);
+            jit = NULL;
+        }
+    }
+
+    // initialise the rewind history, which is optional
+    static Rewind_t rewind;
+    int have_rewind = rewind_megabytes > 0 && init_rewind(&rewind, (size_t)rewind_megabytes * 1024 * 1024);
+    if (rewind_megabytes > 0 && !have_rewind) {
+        SDL_Log("Not enough memory for rewinding\n");
+    }
+
+    // start emulating on its own thread
+    FrameStats_t stats = {0};
+    static Emulator_t emulator;
+    emulator.chip8 = &chip8;
+    emulator.jit = jit;
+    emulator.rewind = have_rewind ? &rewind : NULL;
+    emulator.cycles_per_frame = cycles_per_frame;
+    emulator.stats = &stats;
+    init_frame_exchange(&emulator.frames);
+    atomic_init(&emulator.keys, 0);
+    atomic_init(&emulator.running, 1);
+    atomic_init(&emulator.state_request, STATE_NONE);
+    atomic_init(&emulator.rewinding, 0);
+    snprintf(emulator.state_path, sizeof emulator.state_path, "%s.state", rom_path);
+    emulator.frame_event = SDL_RegisterEvents(1);
+    atomic_init(&emulator.frame_event_pending, 0);
+
+    clear_screen(&sdl);
+    SDL_Thread *thread = SDL_CreateThread(emulation_thread, "emulation", &emulator);
+    if (!thread) {
+        SDL_Log(
+            "Unable to create emulation thread: %s\n",
+            SDL_GetError()
+        );
+        atomic_store(&emulator.running, 0);
+    }
+
+    // main loop: input and display only. It sleeps in SDL_WaitEventTimeout until there is input or the emulation
+    // thread signals a new frame, and the emulation thread sleeps between frames without spinning (see Scheduler_t),
+    // so an idle instance wakes little more than twice a frame: under 1% of a core where it was measured. The timeout
+    // is one frame, in case a wake-up is ever missed.
+    uint64_t shown[SCREEN_HEIGHT] = {0};
+    while (atomic_load_explicit(&emulator.running, memory_order_relaxed)) {
+        int force_redraw = 0;
 
-    // main loop
-    int running = 1;
-    while (running) {
         SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_QUIT: {
-                    running = 0;
-                } break;
+        if (SDL_WaitEventTimeout(&event, 1000 / FRAME_RATE)) {
+            handle_event(&emulator, &event, &force_redraw);
+            while (SDL_PollEvent(&event)) {
+                handle_event(&emulator, &event, &force_redraw);
             }
         }
+
+        const Frame_t *frame = take_frame(&emulator.frames);
+        if (frame || force_redraw) {
+            update_screen(&sdl, frame, shown, &stats);
+        }
+    }
+
+    if (thread) {
+        SDL_WaitThread(thread, NULL);
     }
 
+    print_frame_stats(&stats);
+#ifdef CHIP8_PROFILE
+    print_profile(&chip8);
+#endif
+    print_scheduler_stats(&emulator.scheduler);
+    if (chip8.idle_cycles) {
+        printf("%llu instructions skipped in wait loops\n", chip8.idle_cycles);
+    }
+
+    if (jit) {
+        destroy_jit(jit);
+        free(jit);
+    }
+    if (have_rewind) {
+        destroy_rewind(&rewind);
+    }
     destroy_sdl(&sdl); // destroys sdl
 
     exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
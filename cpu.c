@@ -1,19 +1,52 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cpu.h"
+// Building with -DCHIP8_SCALAR_DXYN leaves the vector sprite blitter out, so that opcode_Dxyn always draws a row at
+// a time; opcode_Dxyn_scalar does the same in any build
+#if defined(__AVX2__) && !defined(CHIP8_SCALAR_DXYN)
+#define CHIP8_DXYN_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) && !defined(CHIP8_SCALAR_DXYN)
+#define CHIP8_DXYN_SSE2
+#include <emmintrin.h>
+#endif
+#include "fontset.h"
+
+// Every store into memory goes through here so that any decoded instruction overlapping the written byte is
+// dropped from the decode cache.
+// Writes into pages holding translated code are flagged for each code cache to pick up, and every write is counted
+// against its 256-byte page for snapshots (see dirty_pages).
+static inline void store_memory(Chip8_t *chip8, unsigned short address, unsigned char value) {
+    address &= 0x0FFF;
+    chip8->memory[address] = value;
+//    an instruction starting up to 3 bytes earlier covers this byte once fused with the instruction after it
+    chip8->decoded[address].handler = NULL;
+    chip8->decoded[(address - 1) & 0x0FFF].handler = NULL;
+    chip8->decoded[(address - 2) & 0x0FFF].handler = NULL;
+    chip8->decoded[(address - 3) & 0x0FFF].handler = NULL;
+    for (int cache = 0; cache < CODE_CACHES; cache++) {
+        chip8->written_code_pages[cache] |= chip8->code_pages[cache] & (1ULL << (address >> 6));
+    }
+    chip8->page_stores[address / MEMORY_PAGE_SIZE]++;
+    chip8->side_effect = 1;
+}
 
 // 00E0 - CLS
 // Clears the Display
 void opcode_00E0(Chip8_t *chip8){
-    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+    for (int i = 0; i < SCREEN_HEIGHT; i++) {
         chip8->gfx[i] = 0;
     }
+    chip8->dirty_rows = 0xFFFFFFFF;
+    chip8->draw_flag = 1;
 }
 
 // 00EE - RET
 // Return from a subroutine
 void opcode_00EE(Chip8_t *chip8){
+    chip8->sp = (chip8->sp - 1) & (STACK_SIZE - 1);
     chip8->pc = chip8->stack[chip8->sp]; // set pc to top of stack
-    chip8->sp--;
 }
 
 // 1nnn - JP addr
@@ -25,10 +58,9 @@ void opcode_1nnn(Chip8_t *chip8, unsigned short nnn) {
 // 2nnn - CALL addr
 // Call subroutine at nnn
 void opcode_2nnn(Chip8_t *chip8, unsigned short nnn) {
-    chip8 -> stack[chip8 -> sp] = chip8 -> pc;
-    ++chip8 -> pc;
+    chip8 -> stack[chip8 -> sp] = chip8 -> pc; // pc already points at the return address
+    chip8 -> sp = (chip8 -> sp + 1) & (STACK_SIZE - 1);
     chip8 -> pc = nnn;
-
 }
 
 // 3xkk - SE Vx, byte
@@ -96,18 +128,21 @@ void opcode_8xy3(Chip8_t *chip8, unsigned short x, unsigned short y) {
 //The values of Vx and Vy are added together. If the result is greater than 8
 // bits (i.e., > 255) VF is set to 1, otherwise 0. Only the lowest 8 bits of the
 // result are kept, and stored in Vx.
+// Like the rest of the 8xy_ group, VF is written after Vx, so when x is F the flag wins.
 void opcode_8xy4(Chip8_t *chip8, unsigned short x, unsigned short y) {
-    chip8-> V[0x0F] = (chip8-> V[x] + chip8->V[y]) > 0xFF00 ? 1 : 0;
-    chip8-> V[x] += chip8->V[y];
+    unsigned short sum = chip8->V[x] + chip8->V[y];
+    chip8-> V[x] = sum & 0xFF;
+    chip8-> V[0x0F] = sum > 0xFF ? 1 : 0;
 }
 
 //8xy5 - SUB Vx, Vy
 //Set Vx = Vx - Vy, set VF = NOT borrow.
-//If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx,
+//If Vx >= Vy (no borrow), then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx,
 //and the results stored in Vx.
 void opcode_8xy5(Chip8_t *chip8, unsigned short x, unsigned short y) {
-    chip8-> V[0x0F] = (chip8-> V[x] > chip8->V[y]) ? 1 : 0;
+    unsigned char not_borrow = (chip8-> V[x] >= chip8->V[y]) ? 1 : 0;
     chip8-> V[x] = chip8->V[x] - chip8->V[y];
+    chip8-> V[0x0F] = not_borrow;
 }
 
 //8xy6 - SHR Vx {, Vy}
@@ -115,17 +150,19 @@ void opcode_8xy5(Chip8_t *chip8, unsigned short x, unsigned short y) {
 //If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0.
 //Then Vx is divided by 2.
 void opcode_8xy6(Chip8_t *chip8, unsigned  short x) {
-    chip8 -> V[0x0F] = (chip8 -> V[x] & 1);
+    unsigned char lsb = chip8 -> V[x] & 1;
     chip8 -> V[x] >>= 1;
+    chip8 -> V[0x0F] = lsb;
 }
 
 // 8xy7 - SUBN Vx, Vy
 //Set Vx = Vy - Vx, set VF = NOT borrow.
-//If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy,
+//If Vy >= Vx (no borrow), then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy,
 // and the results stored in Vx.
 void opcode_8xy7(Chip8_t *chip8, unsigned short x, unsigned short y) {
-    chip8-> V[0x0F] = (chip8-> V[y] > chip8->V[x]) ? 1 : 0;
-    chip8-> V[y] = chip8->V[y] - chip8->V[x];
+    unsigned char not_borrow = (chip8-> V[y] >= chip8->V[x]) ? 1 : 0;
+    chip8-> V[x] = chip8->V[y] - chip8->V[x];
+    chip8-> V[0x0F] = not_borrow;
 }
 
 //8xyE - SHL Vx {, Vy}
@@ -133,8 +170,9 @@ void opcode_8xy7(Chip8_t *chip8, unsigned short x, unsigned short y) {
 //If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0.
 // Then Vx is multiplied by 2.
 void opcode_8xyE(Chip8_t *chip8, unsigned short x) {
-    chip8-> V[0x0F] = (chip8 -> V[x] >> 0x0F);
+    unsigned char msb = chip8 -> V[x] >> 7;
     chip8 -> V[x] <<= 1;
+    chip8 -> V[0x0F] = msb;
 }
 
 //9xy0 - SNE Vx, Vy
@@ -158,7 +196,7 @@ void opcode_Annn(Chip8_t *chip8, unsigned short nnn) {
 //Jump to location nnn + V0.
 //The program counter is set to nnn plus the value of V0.
 void opcode_Bnnn(Chip8_t *chip8, unsigned short nnn) {
-    chip8 -> pc = nnn + chip8->V[0x00];
+    chip8 -> pc = (nnn + chip8->V[0x00]) & 0x0FFF;
 }
 
 //Cxkk - RND Vx, byte
@@ -167,7 +205,120 @@ void opcode_Bnnn(Chip8_t *chip8, unsigned short nnn) {
 // ANDed with the value kk.The results are stored in Vx. See instruction
 // 8xy2 for more information on AND
 void opcode_Cxkk(Chip8_t *chip8, unsigned short x, unsigned short kk) {
-    chip8 -> V[x] = (rand() % 256) & kk; // NOLINT(cert-msc30-c, cert-msc50-cpp)
+//    xorshift32: each machine has its own sequence, and no lock is taken when many machines run at once
+    uint32_t random = chip8->random_state;
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    chip8->random_state = random;
+
+    chip8 -> V[x] = (random >> 24) & kk;
+    chip8->side_effect = 1;
+}
+
+void seed_random(Chip8_t *chip8, uint32_t seed) {
+    chip8->random_state = seed ? seed : CHIP8_RANDOM_SEED; // xorshift never leaves zero
+}
+
+// Draws the sprite one row at a time: put the byte at the top of a word, rotate it right into place so that it wraps
+// horizontally, XOR it into the row and keep the pixels that were on in both. Returns non-zero on a collision.
+static uint64_t draw_rows_scalar(Chip8_t *chip8, unsigned int column, unsigned int row, unsigned int n) {
+    uint64_t collision = 0;
+    for (unsigned int line = 0; line < n; line++) {
+        uint64_t sprite = (uint64_t)chip8->memory[(chip8->I + line) & 0x0FFF] << 56;
+        sprite = (sprite >> column) | (sprite << ((SCREEN_WIDTH - column) & (SCREEN_WIDTH - 1)));
+
+        uint64_t *screen_row = &chip8->gfx[(row + line) & (SCREEN_HEIGHT - 1)];
+        collision |= *screen_row & sprite; // pixels that are on and about to be erased
+        *screen_row ^= sprite; // Sprites are XORed onto existing screen
+    }
+    return collision;
+}
+
+#if defined(CHIP8_DXYN_AVX2) || defined(CHIP8_DXYN_SSE2)
+#define ZEROS_8 0, 0, 0, 0, 0, 0, 0, 0
+#define ONES_8 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+// Loading from offset 32 - k gives a mask of bytes k and up, from 64 - k gives a mask of bytes below k
+static const unsigned char sprite_window[96] = {
+    ZEROS_8, ZEROS_8, ZEROS_8, ZEROS_8, ONES_8, ONES_8, ONES_8, ONES_8, ZEROS_8, ZEROS_8, ZEROS_8, ZEROS_8,
+};
+#undef ZEROS_8
+#undef ONES_8
+#endif
+
+#if defined(CHIP8_DXYN_AVX2)
+// Draws the sprite four rows per vector. The screen is split into eight fixed groups of four rows, and the sprite
+// bytes are loaded offset so that they line up with those groups (masking off whatever is outside the sprite). Every
+// vector then covers one whole group, which makes vertical wrapping a matter of which group comes next, and means a
+// draw reads the screen with the same aligned accesses the previous draw wrote it with, so loads are always forwarded
+// from pending stores. Needs memory from I - (row & 3) to 32 bytes past it.
+static uint64_t draw_rows_simd(Chip8_t *chip8, unsigned int column, unsigned int row, unsigned int n) {
+    const unsigned int offset = row & 3;
+    const __m256i keep = _mm256_and_si256(
+        _mm256_loadu_si256((const __m256i *)(sprite_window + 32 - offset)),
+        _mm256_loadu_si256((const __m256i *)(sprite_window + 64 - offset - n)));
+    const __m256i bytes = _mm256_and_si256(
+        _mm256_loadu_si256((const __m256i *)&chip8->memory[chip8->I - offset]), keep);
+//    vector shifts of 64 or more give 0, so column 0 needs no special case here
+    const __m128i right = _mm_cvtsi32_si128((int)column);
+    const __m128i left = _mm_cvtsi32_si128((int)(SCREEN_WIDTH - column));
+
+    __m128i group = _mm256_castsi256_si128(bytes);
+    __m256i hits = _mm256_setzero_si256();
+    for (unsigned int i = 0; i < (offset + n + 3) / 4; i++) {
+        if (i == 4) {
+            group = _mm256_extracti128_si256(bytes, 1);
+        }
+        __m256i sprite = _mm256_slli_epi64(_mm256_cvtepu8_epi64(group), 56);
+        sprite = _mm256_or_si256(_mm256_srl_epi64(sprite, right), _mm256_sll_epi64(sprite, left));
+
+        __m256i *screen = (__m256i *)&chip8->gfx[((row / 4 + i) & 7) * 4];
+        __m256i old = _mm256_loadu_si256(screen);
+        hits = _mm256_or_si256(hits, _mm256_and_si256(old, sprite));
+        _mm256_storeu_si256(screen, _mm256_xor_si256(old, sprite));
+        group = _mm_srli_si128(group, 4);
+    }
+    return !_mm256_testz_si256(hits, hits);
+}
+#define SIMD_SPRITE_BYTES 32
+#define SIMD_SPRITE_ROWS 4
+#elif defined(CHIP8_DXYN_SSE2)
+// Same as the AVX2 version, with sixteen groups of two rows
+static uint64_t draw_rows_simd(Chip8_t *chip8, unsigned int column, unsigned int row, unsigned int n) {
+    const unsigned int offset = row & 1;
+    const __m128i keep = _mm_and_si128(
+        _mm_loadu_si128((const __m128i *)(sprite_window + 32 - offset)),
+        _mm_loadu_si128((const __m128i *)(sprite_window + 64 - offset - n)));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i right = _mm_cvtsi32_si128((int)column);
+    const __m128i left = _mm_cvtsi32_si128((int)(SCREEN_WIDTH - column));
+
+    __m128i group = _mm_and_si128(_mm_loadu_si128((const __m128i *)&chip8->memory[chip8->I - offset]), keep);
+    __m128i hits = zero;
+    for (unsigned int i = 0; i < (offset + n + 1) / 2; i++) {
+//        interleaving with zero three times moves each of the two low bytes to the top of its own 64-bit lane
+        __m128i sprite = _mm_unpacklo_epi32(zero, _mm_unpacklo_epi16(zero, _mm_unpacklo_epi8(zero, group)));
+        sprite = _mm_or_si128(_mm_srl_epi64(sprite, right), _mm_sll_epi64(sprite, left));
+
+        __m128i *screen = (__m128i *)&chip8->gfx[((row / 2 + i) & 15) * 2];
+        __m128i old = _mm_loadu_si128(screen);
+        hits = _mm_or_si128(hits, _mm_and_si128(old, sprite));
+        _mm_storeu_si128(screen, _mm_xor_si128(old, sprite));
+        group = _mm_srli_si128(group, 2);
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(hits, zero)) != 0xFFFF;
+}
+#define SIMD_SPRITE_BYTES 16
+#define SIMD_SPRITE_ROWS 2
+#endif
+
+// Sets VF and marks the n rows from row down, wrapping to the top, for redrawing
+static void finish_draw(Chip8_t *chip8, unsigned int row, unsigned int n, uint64_t collision) {
+    chip8->V[0x0F] = collision != 0;
+    chip8->draw_flag = 1; // Set draw flag to true
+
+    uint32_t rows = (1u << n) - 1;
+    chip8->dirty_rows |= rows << row | rows >> ((SCREEN_HEIGHT - row) & (SCREEN_HEIGHT - 1));
 }
 
 //Dxyn - DRW Vx, Vy, nibble
@@ -178,22 +329,35 @@ void opcode_Cxkk(Chip8_t *chip8, unsigned short x, unsigned short kk) {
 // it wraps around to the opposite side of the screen. See instruction 8xy3 for more information on XOR,
 // and section 2.4, Display, for more information on the Chip-8 screen and sprites.
 void opcode_Dxyn(Chip8_t *chip8, unsigned short x, unsigned short y, unsigned short n){
-    unsigned short pixel;
-    chip8->V[0x0F] = 0;
-    int yline;
-    int xline;
-    for (yline = 0; yline < n; yline++){
-        pixel = chip8-> memory[chip8->I + yline]; // reading bytes from memory
-        for (xline = 0; xline < 8; xline++) {
-            if ((pixel & (0x80 >> xline)) != 0) {
-                chip8->V[0x0F] = chip8 -> gfx[(x + xline + ((y + yline) * 64))]; // Setting VF flag is a pixel is erased
-                chip8->gfx[(x + xline + ((y + yline) * 64))] ^= 1; // Sprites are XORed onto existing screen
-            }
-        }
+    unsigned int column = chip8->V[x] & (SCREEN_WIDTH - 1);
+    unsigned int row = chip8->V[y] & (SCREEN_HEIGHT - 1);
+    uint64_t collision;
+
+#ifdef SIMD_SPRITE_BYTES
+//    the vector load reaches a few bytes either side of the sprite, so sprites at the very ends of memory (which
+//    also have to wrap around it) take the scalar path
+    unsigned int start = chip8->I - row % SIMD_SPRITE_ROWS;
+    if (chip8->I >= row % SIMD_SPRITE_ROWS && start + SIMD_SPRITE_BYTES <= MEMORY_SIZE) {
+        collision = draw_rows_simd(chip8, column, row, n);
+    } else {
+        collision = draw_rows_scalar(chip8, column, row, n);
     }
+#else
+    collision = draw_rows_scalar(chip8, column, row, n);
+#endif
 
-    chip8->draw_flag = 1; // Set draw flag to true
-    chip8->pc += 2; // increment pc
+    finish_draw(chip8, row, n, collision);
+}
+
+// Dxyn a row at a time whatever the build, to compare the vector path against (see chip8-bench --draw)
+void opcode_Dxyn_scalar(Chip8_t *chip8, unsigned short x, unsigned short y, unsigned short n) {
+    unsigned int column = chip8->V[x] & (SCREEN_WIDTH - 1);
+    unsigned int row = chip8->V[y] & (SCREEN_HEIGHT - 1);
+    finish_draw(chip8, row, n, draw_rows_scalar(chip8, column, row, n));
+}
+
+int get_pixel(const Chip8_t *chip8, int x, int y) {
+    return chip8->gfx[y & (SCREEN_HEIGHT - 1)] >> (63 - (x & (SCREEN_WIDTH - 1))) & 1;
 }
 
 //Ex9E - SKP Vx
@@ -201,7 +365,7 @@ void opcode_Dxyn(Chip8_t *chip8, unsigned short x, unsigned short y, unsigned sh
 //Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position,
 // PC is increased by 2.
 void opcode_Ex9E(Chip8_t *chip8, unsigned short x) {
-    chip8->pc += (chip8->keypad[chip8->V[x]]) ? 2 : 0;
+    chip8->pc += (chip8->keypad[chip8->V[x] & 0x0F]) ? 2 : 0;
 }
 
 //ExA1 - SKNP Vx
@@ -209,7 +373,7 @@ void opcode_Ex9E(Chip8_t *chip8, unsigned short x) {
 //Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position,
 // PC is increased by 2.
 void opcode_ExA1(Chip8_t *chip8, unsigned short x) {
-    chip8->pc += (!chip8->keypad[chip8->V[x]]) ? 2 : 0;
+    chip8->pc += (!chip8->keypad[chip8->V[x] & 0x0F]) ? 2 : 0;
 }
 
 //Fx07 - LD Vx, DT
@@ -273,9 +437,9 @@ void opcode_Fx29(Chip8_t *chip8, unsigned short x){
 void opcode_Fx33(Chip8_t *chip8, unsigned short x) {
     unsigned short I = chip8->I;
 
-    chip8->V[I] = chip8->V[x] / 100;
-    chip8->V[I+1] = (chip8->V[x] / 10) % 10;
-    chip8->V[I+2] = (chip8->V[x] % 100) % 10;
+    store_memory(chip8, I, chip8->V[x] / 100);
+    store_memory(chip8, I + 1, (chip8->V[x] / 10) % 10);
+    store_memory(chip8, I + 2, chip8->V[x] % 10);
 }
 
 //Fx55 - LD [I], Vx
@@ -285,7 +449,7 @@ void opcode_Fx55(Chip8_t *chip8, unsigned short x) {
     unsigned short I = chip8->I;
     int i;
     for (i = 0; i <= x; i++) {
-        chip8->memory[I + i];
+        store_memory(chip8, I + i, chip8->V[i]);
     }
 }
 
@@ -296,161 +460,727 @@ void opcode_Fx65(Chip8_t *chip8, unsigned short x) {
     unsigned short I = chip8->I;
     int i;
     for (i = 0; i <= x; i++) {
-        chip8->V[i] = chip8->memory[I+i];
+        chip8->V[i] = chip8->memory[(I + i) & 0x0FFF];
     }
 }
 
 
-void emulate_cycle(Chip8_t *chip8){
-//    fetch opcode
-    chip8 -> opcode = chip8 -> memory[chip8 -> pc] << 8 | chip8 -> memory[chip8 -> pc + 1];
-
-// register identifiers
-    unsigned short x = (chip8->opcode & 0x0F00) >> 8;
-    unsigned short y = (chip8->opcode & 0x0F00) >> 4;
-
-//    constants
-    unsigned short nn = chip8->opcode & 0x00FF;
-    unsigned short nnn = chip8 ->opcode & 0x0FFF;
-    
-//    decode opcode
-    switch (chip8->opcode & 0xF000) {
+// Adapters giving every handler the uniform OpcodeHandler_t signature, so that the decode table can dispatch
+// any opcode with a single indirect call. Each one just forwards the pre-extracted operands.
+static void exec_00E0(Chip8_t *chip8, const Instruction_t *in) { (void)in; opcode_00E0(chip8); }
+static void exec_00EE(Chip8_t *chip8, const Instruction_t *in) { (void)in; opcode_00EE(chip8); }
+static void exec_1nnn(Chip8_t *chip8, const Instruction_t *in) { opcode_1nnn(chip8, in->nnn); }
+static void exec_2nnn(Chip8_t *chip8, const Instruction_t *in) { opcode_2nnn(chip8, in->nnn); }
+static void exec_3xkk(Chip8_t *chip8, const Instruction_t *in) { opcode_3xkk(chip8, in->x, in->kk); }
+static void exec_4xkk(Chip8_t *chip8, const Instruction_t *in) { opcode_4xkk(chip8, in->x, in->kk); }
+static void exec_5xy0(Chip8_t *chip8, const Instruction_t *in) { opcode_5xy0(chip8, in->x, in->y); }
+static void exec_6xkk(Chip8_t *chip8, const Instruction_t *in) { opcode_6xkk(chip8, in->x, in->kk); }
+static void exec_7xkk(Chip8_t *chip8, const Instruction_t *in) { opcode_7xkk(chip8, in->x, in->kk); }
+static void exec_8xy0(Chip8_t *chip8, const Instruction_t *in) { opcode_8xy0(chip8, in->x, in->y); }
+static void exec_8xy1(Chip8_t *chip8, const Instruction_t *in) { opcode_8xy1(chip8, in->x, in->y); }
+static void exec_8xy2(Chip8_t *chip8, const Instruction_t *in) { opcode_8xy2(chip8, in->x, in->y); }
+static void exec_8xy3(Chip8_t *chip8, const Instruction_t *in) { opcode_8xy3(chip8, in->x, in->y); }
+static void exec_8xy4(Chip8_t *chip8, const Instruction_t *in) { opcode_8xy4(chip8, in->x, in->y); }
+static void exec_8xy5(Chip8_t *chip8, const Instruction_t *in) { opcode_8xy5(chip8, in->x, in->y); }
+static void exec_8xy6(Chip8_t *chip8, const Instruction_t *in) { opcode_8xy6(chip8, in->x); }
+static void exec_8xy7(Chip8_t *chip8, const Instruction_t *in) { opcode_8xy7(chip8, in->x, in->y); }
+static void exec_8xyE(Chip8_t *chip8, const Instruction_t *in) { opcode_8xyE(chip8, in->x); }
+static void exec_9xy0(Chip8_t *chip8, const Instruction_t *in) { opcode_9xy0(chip8, in->x, in->y); }
+static void exec_Annn(Chip8_t *chip8, const Instruction_t *in) { opcode_Annn(chip8, in->nnn); }
+static void exec_Bnnn(Chip8_t *chip8, const Instruction_t *in) { opcode_Bnnn(chip8, in->nnn); }
+static void exec_Cxkk(Chip8_t *chip8, const Instruction_t *in) { opcode_Cxkk(chip8, in->x, in->kk); }
+static void exec_Dxyn(Chip8_t *chip8, const Instruction_t *in) { opcode_Dxyn(chip8, in->x, in->y, in->n); }
+static void exec_Ex9E(Chip8_t *chip8, const Instruction_t *in) { opcode_Ex9E(chip8, in->x); }
+static void exec_ExA1(Chip8_t *chip8, const Instruction_t *in) { opcode_ExA1(chip8, in->x); }
+static void exec_Fx07(Chip8_t *chip8, const Instruction_t *in) { opcode_Fx07(chip8, in->x); }
+static void exec_Fx0A(Chip8_t *chip8, const Instruction_t *in) { opcode_Fx0A(chip8, in->x); }
+static void exec_Fx15(Chip8_t *chip8, const Instruction_t *in) { opcode_Fx15(chip8, in->x); }
+static void exec_Fx18(Chip8_t *chip8, const Instruction_t *in) { opcode_Fx18(chip8, in->x); }
+static void exec_Fx1E(Chip8_t *chip8, const Instruction_t *in) { opcode_Fx1E(chip8, in->x); }
+static void exec_Fx29(Chip8_t *chip8, const Instruction_t *in) { opcode_Fx29(chip8, in->x); }
+static void exec_Fx33(Chip8_t *chip8, const Instruction_t *in) { opcode_Fx33(chip8, in->x); }
+static void exec_Fx55(Chip8_t *chip8, const Instruction_t *in) { opcode_Fx55(chip8, in->x); }
+static void exec_Fx65(Chip8_t *chip8, const Instruction_t *in) { opcode_Fx65(chip8, in->x); }
+
+// 0nnn - SYS addr
+// Jump to a machine code routine at nnn. Ignored by modern interpreters.
+static void exec_0nnn(Chip8_t *chip8, const Instruction_t *in) { (void)chip8; (void)in; }
+
+// Anything that decodes to no instruction does nothing. It is counted rather than printed, so that the library
+// writes nothing to stdout; the frontends report it. Counting is a side effect, so a loop running one isn't idle.
+static void exec_unknown(Chip8_t *chip8, const Instruction_t *in) {
+    (void)in;
+    chip8->unknown_opcodes++;
+    chip8->last_unknown = chip8->opcode;
+    chip8->side_effect = 1;
+}
+
+// Fused pairs: each runs two consecutive instructions in one dispatch. pc already points at the second one when the
+// handler starts, just as it would after the first instruction was dispatched on its own. The second instruction's
+// operands go in whichever fields the first one leaves unused.
+static void exec_Annn_Dxyn(Chip8_t *chip8, const Instruction_t *in) {
+    opcode_Annn(chip8, in->nnn);
+    chip8->pc = (chip8->pc + 2) & 0x0FFF;
+    chip8->opcode = 0xD000 | in->x << 8 | in->y << 4 | in->n;
+    opcode_Dxyn(chip8, in->x, in->y, in->n);
+    chip8->fusion_count[FUSE_ANNN_DXYN]++;
+}
+
+static void exec_Annn_Fx65(Chip8_t *chip8, const Instruction_t *in) {
+    opcode_Annn(chip8, in->nnn);
+    chip8->pc = (chip8->pc + 2) & 0x0FFF;
+    chip8->opcode = 0xF065 | in->x << 8;
+    opcode_Fx65(chip8, in->x);
+    chip8->fusion_count[FUSE_ANNN_FX65]++;
+}
+
+// y holds the x of Fx29
+static void exec_6xkk_Fx29(Chip8_t *chip8, const Instruction_t *in) {
+    opcode_6xkk(chip8, in->x, in->kk);
+    chip8->pc = (chip8->pc + 2) & 0x0FFF;
+    chip8->opcode = 0xF029 | in->y << 8;
+    opcode_Fx29(chip8, in->y);
+    chip8->fusion_count[FUSE_6XKK_FX29]++;
+}
+
+// y and n hold the x and kk of 3xkk
+static void exec_7xkk_3xkk(Chip8_t *chip8, const Instruction_t *in) {
+    opcode_7xkk(chip8, in->x, in->kk);
+    chip8->pc = (chip8->pc + 2) & 0x0FFF;
+    chip8->opcode = 0x3000 | in->y << 8 | in->n;
+    opcode_3xkk(chip8, in->y, in->n);
+    chip8->fusion_count[FUSE_7XKK_3XKK]++;
+}
+
+static const char *const fusion_names[FUSION_KINDS] = {
+    "Annn+Dxyn", "Annn+Fx65", "6xkk+Fx29", "7xkk+3xkk",
+};
+
+// Every handler, in the order of the labels in run_threaded; an instruction's kind is its handler's index here
+static const OpcodeHandler_t handler_kinds[] = {
+    exec_00E0, exec_00EE, exec_0nnn, exec_1nnn, exec_2nnn, exec_3xkk, exec_4xkk, exec_5xy0, exec_6xkk, exec_7xkk,
+    exec_8xy0, exec_8xy1, exec_8xy2, exec_8xy3, exec_8xy4, exec_8xy5, exec_8xy6, exec_8xy7, exec_8xyE, exec_9xy0,
+    exec_Annn, exec_Bnnn, exec_Cxkk, exec_Dxyn, exec_Ex9E, exec_ExA1, exec_Fx07, exec_Fx0A, exec_Fx15, exec_Fx18,
+    exec_Fx1E, exec_Fx29, exec_Fx33, exec_Fx55, exec_Fx65, exec_unknown,
+    exec_Annn_Dxyn, exec_Annn_Fx65, exec_6xkk_Fx29, exec_7xkk_3xkk,
+};
+
+#ifdef CHIP8_PROFILE
+_Static_assert(sizeof handler_kinds / sizeof handler_kinds[0] == PROFILE_KINDS, "PROFILE_KINDS is out of date");
+
+static const char *const kind_names[PROFILE_KINDS] = {
+    "00E0", "00EE", "0nnn", "1nnn", "2nnn", "3xkk", "4xkk", "5xy0", "6xkk", "7xkk",
+    "8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5", "8xy6", "8xy7", "8xyE", "9xy0",
+    "Annn", "Bnnn", "Cxkk", "Dxyn", "Ex9E", "ExA1", "Fx07", "Fx0A", "Fx15", "Fx18",
+    "Fx1E", "Fx29", "Fx33", "Fx55", "Fx65", "unknown",
+    "Annn+Dxyn", "Annn+Fx65", "6xkk+Fx29", "7xkk+3xkk",
+};
+#endif
+
+static unsigned char kind_of(OpcodeHandler_t handler) {
+    for (unsigned char i = 0; i < sizeof handler_kinds / sizeof handler_kinds[0]; i++) {
+        if (handler_kinds[i] == handler) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// decode_table maps every raw 16-bit opcode to its handler and operands. It is filled once by build_decode_table
+// and shared by all machines, so executing an instruction never has to decode it again.
+static Instruction_t decode_table[0x10000];
+static int decode_table_built = 0;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CHIP8_THREADED 1 // labels-as-values are available, see run_threaded
+#else
+#define CHIP8_THREADED 0
+#endif
+
+// Picks the handler for an opcode. This is only run while building the decode table, never per cycle.
+static OpcodeHandler_t decode_handler(unsigned short opcode) {
+    switch (opcode & 0xF000) {
         case 0x0000:
-            switch (chip8->opcode & 0x000F) {
-                case 0x0000:
-                    opcode_00E0(chip8);
-                    break;
-                case 0x000E:
-                    opcode_00EE(chip8);
-                    break;
+            switch (opcode) {
+                case 0x00E0: return exec_00E0;
+                case 0x00EE: return exec_00EE;
+            }
+            return exec_0nnn;
+        case 0x1000: return exec_1nnn;
+        case 0x2000: return exec_2nnn;
+        case 0x3000: return exec_3xkk;
+        case 0x4000: return exec_4xkk;
+        case 0x5000:
+            if ((opcode & 0x000F) == 0x0000) {
+                return exec_5xy0;
             }
             break;
-        case 0x1000:
-            opcode_1nnn(chip8, nnn);
+        case 0x6000: return exec_6xkk;
+        case 0x7000: return exec_7xkk;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0000: return exec_8xy0;
+                case 0x0001: return exec_8xy1;
+                case 0x0002: return exec_8xy2;
+                case 0x0003: return exec_8xy3;
+                case 0x0004: return exec_8xy4;
+                case 0x0005: return exec_8xy5;
+                case 0x0006: return exec_8xy6;
+                case 0x0007: return exec_8xy7;
+                case 0x000E: return exec_8xyE;
+            }
             break;
-        case 0x2000:
-            opcode_2nnn(chip8, nnn);
+        case 0x9000:
+            if ((opcode & 0x000F) == 0x0000) {
+                return exec_9xy0;
+            }
             break;
-        case 0x3000:
-            opcode_3xkk(chip8, x, nn);
+        case 0xA000: return exec_Annn;
+        case 0xB000: return exec_Bnnn;
+        case 0xC000: return exec_Cxkk;
+        case 0xD000: return exec_Dxyn;
+        case 0xE000:
+            switch (opcode & 0x00FF) {
+                case 0x009E: return exec_Ex9E;
+                case 0x00A1: return exec_ExA1;
+            }
             break;
-        case 0x4000:
-            opcode_4xkk(chip8, x, nn);
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0007: return exec_Fx07;
+                case 0x000A: return exec_Fx0A;
+                case 0x0015: return exec_Fx15;
+                case 0x0018: return exec_Fx18;
+                case 0x001E: return exec_Fx1E;
+                case 0x0029: return exec_Fx29;
+                case 0x0033: return exec_Fx33;
+                case 0x0055: return exec_Fx55;
+                case 0x0065: return exec_Fx65;
+            }
             break;
-        case 0x5000:
-            opcode_5xy0(chip8, x, y);
+    }
+    return exec_unknown;
+}
+
+static void build_decode_table(void) {
+    if (decode_table_built) {
+        return;
+    }
+
+    for (unsigned int opcode = 0; opcode <= 0xFFFF; opcode++) {
+        Instruction_t *instruction = &decode_table[opcode];
+        instruction->handler = decode_handler(opcode);
+        instruction->nnn = opcode & 0x0FFF;
+        instruction->x = (opcode & 0x0F00) >> 8;
+        instruction->y = (opcode & 0x00F0) >> 4;
+        instruction->kk = opcode & 0x00FF;
+        instruction->n = opcode & 0x000F;
+        instruction->opcode = opcode;
+        instruction->length = 1;
+        instruction->kind = kind_of(instruction->handler);
+    }
+
+    decode_table_built = 1;
+}
+
+// Replaces a freshly decoded instruction with a fused pair when it and the instruction after it form one of the
+// FUSE_ patterns. Only code that actually executes is decoded, so only pairs on live paths are fused.
+static void fuse_instruction(Chip8_t *chip8, Instruction_t *instruction, unsigned short pc) {
+    unsigned short next_pc = (pc + 2) & 0x0FFF;
+    const Instruction_t *next = &decode_table[chip8->memory[next_pc] << 8 | chip8->memory[(next_pc + 1) & 0x0FFF]];
+
+    if (instruction->handler == exec_Annn && next->handler == exec_Dxyn) {
+        instruction->handler = exec_Annn_Dxyn;
+        instruction->x = next->x;
+        instruction->y = next->y;
+        instruction->n = next->n;
+    } else if (instruction->handler == exec_Annn && next->handler == exec_Fx65) {
+        instruction->handler = exec_Annn_Fx65;
+        instruction->x = next->x;
+    } else if (instruction->handler == exec_6xkk && next->handler == exec_Fx29) {
+        instruction->handler = exec_6xkk_Fx29;
+        instruction->y = next->x;
+    } else if (instruction->handler == exec_7xkk && next->handler == exec_3xkk) {
+        instruction->handler = exec_7xkk_3xkk;
+        instruction->y = next->x;
+        instruction->n = next->kk;
+    } else {
+        return;
+    }
+
+    instruction->length = 2;
+    instruction->kind = kind_of(instruction->handler);
+}
+
+// Returns the decoded instruction at pc, fetching and decoding it only the first time that address is executed
+// (or the first time after a store overwrote it). The result may be a fused pair; callers that must execute exactly
+// one instruction use decode_table[instruction->opcode] instead when length is 2.
+static inline const Instruction_t *fetch_decoded(Chip8_t *chip8, unsigned short pc) {
+    Instruction_t *instruction = &chip8->decoded[pc & 0x0FFF];
+    if (!instruction->handler) {
+        unsigned short opcode = chip8->memory[pc & 0x0FFF] << 8 | chip8->memory[(pc + 1) & 0x0FFF];
+        *instruction = decode_table[opcode];
+        fuse_instruction(chip8, instruction, pc & 0x0FFF);
+    }
+    return instruction;
+}
+
+const Instruction_t *decode_at(Chip8_t *chip8, unsigned short address) {
+    return &decode_table[fetch_decoded(chip8, address)->opcode];
+}
+
+void print_fusion_stats(const Chip8_t *chip8) {
+    unsigned long long saved = 0;
+    for (int i = 0; i < FUSION_KINDS; i++) {
+        printf("%-10s %12llu\n", fusion_names[i], chip8->fusion_count[i]);
+        saved += chip8->fusion_count[i];
+    }
+//    every fused pair executed is one dispatch that did not happen
+    printf("dispatches saved: %llu\n", saved);
+}
+
+#ifdef CHIP8_PROFILE
+// Counts one instruction, about to run from pc, into the machine's profile
+static void profile_instruction(Chip8_t *chip8, const Instruction_t *instruction, unsigned short pc) {
+    Profile_t *profile = &chip8->profile;
+    profile->kind_count[instruction->kind]++;
+    profile->pc_count[pc]++;
+    if (instruction->length > 1) {
+        profile->pc_count[(pc + 2) & 0x0FFF]++;
+    }
+
+    profile->since_draw += instruction->length;
+    if (instruction->handler == exec_Dxyn || instruction->handler == exec_Annn_Dxyn) {
+        int bucket = 0;
+        while (bucket + 1 < PROFILE_DRAW_BUCKETS && profile->since_draw >> (bucket + 1)) {
+            bucket++;
+        }
+        profile->draw_gaps[bucket]++;
+        profile->since_draw = 0;
+    }
+}
+#define PROFILE_INSTRUCTION(chip8, instruction, pc) profile_instruction(chip8, instruction, pc)
+
+// Returns the index of the largest count not yet marked as shown, and marks it, or -1 once they are all zero
+static int next_hottest(const unsigned long long *counts, unsigned char *shown, int size) {
+    int hottest = -1;
+    for (int i = 0; i < size; i++) {
+        if (!shown[i] && counts[i] && (hottest < 0 || counts[i] > counts[hottest])) {
+            hottest = i;
+        }
+    }
+    if (hottest >= 0) {
+        shown[hottest] = 1;
+    }
+    return hottest;
+}
+
+void print_profile(const Chip8_t *chip8) {
+    const Profile_t *profile = &chip8->profile;
+    unsigned long long total = 0;
+    for (int i = 0; i < PROFILE_KINDS; i++) {
+        total += profile->kind_count[i];
+    }
+    if (!total) {
+        return;
+    }
+
+//    a fused pair is one execution of its kind but two instructions, so these add up to slightly less than total
+    printf("executions by handler (%llu, not counting %llu skipped in wait loops):\n", total, chip8->idle_cycles);
+    unsigned char shown[MEMORY_SIZE] = {0};
+    for (int kind; (kind = next_hottest(profile->kind_count, shown, PROFILE_KINDS)) >= 0;) {
+        printf("  %-10s %14llu %6.2f%%\n", kind_names[kind], profile->kind_count[kind],
+               100.0 * (double)profile->kind_count[kind] / (double)total);
+    }
+
+    printf("instructions between draws:\n");
+    for (int bucket = 0; bucket < PROFILE_DRAW_BUCKETS; bucket++) {
+        if (profile->draw_gaps[bucket]) {
+            printf("  %6llu-%-6llu %14llu\n", 1ULL << bucket, (2ULL << bucket) - 1, profile->draw_gaps[bucket]);
+        }
+    }
+
+    printf("hottest addresses:\n");
+    memset(shown, 0, sizeof shown);
+    for (int rank = 0; rank < PROFILE_HOT_ADDRESSES; rank++) {
+        int address = next_hottest(profile->pc_count, shown, MEMORY_SIZE);
+        if (address < 0) {
             break;
-        case 0x6000:
-            opcode_6xkk(chip8, x, nn);
+        }
+        unsigned short opcode = chip8->memory[address] << 8 | chip8->memory[(address + 1) & 0x0FFF];
+        char text[32];
+        disassemble(opcode, text, sizeof text);
+        printf("  %03X %14llu %6.2f%%  %04X  %s\n", address, profile->pc_count[address],
+               100.0 * (double)profile->pc_count[address] / (double)total, opcode, text);
+    }
+}
+#else
+#define PROFILE_INSTRUCTION(chip8, instruction, pc) ((void)0)
+#endif
+
+void flush_decode_cache(Chip8_t *chip8) {
+    for (int i = 0; i < MEMORY_SIZE; i++) {
+        chip8->decoded[i].handler = NULL;
+    }
+
+//    any translated block may be stale as well, and any snapshot
+    for (int cache = 0; cache < CODE_CACHES; cache++) {
+        chip8->written_code_pages[cache] |= chip8->code_pages[cache];
+    }
+    for (int page = 0; page < MEMORY_PAGES; page++) {
+        chip8->page_stores[page]++;
+    }
+}
+
+uint16_t dirty_pages(const Chip8_t *chip8, unsigned int seen[MEMORY_PAGES]) {
+//    a counter rather than a flag per page, so that any number of snapshot takers can each keep their own copy
+    uint16_t pages = 0;
+    for (int page = 0; page < MEMORY_PAGES; page++) {
+        pages |= (uint16_t)(chip8->page_stores[page] != seen[page]) << page;
+        seen[page] = chip8->page_stores[page];
+    }
+    return pages;
+}
+
+void emulate_cycle(Chip8_t *chip8){
+//    fetch the decoded instruction; in a loop that has run before this does no decode work at all
+    const Instruction_t *instruction = fetch_decoded(chip8, chip8->pc);
+    if (instruction->length > 1) {
+        instruction = &decode_table[instruction->opcode]; // one instruction per call, never a fused pair
+    }
+    chip8->opcode = instruction->opcode;
+    PROFILE_INSTRUCTION(chip8, instruction, chip8->pc & 0x0FFF);
+
+//    pc points at the next instruction before executing, so jumps, calls and skips write it directly
+    chip8->pc = (chip8->pc + 2) & 0x0FFF;
+
+//    execute: one indirect call
+    instruction->handler(chip8, instruction);
+}
+
+void set_breakpoint(Chip8_t *chip8, unsigned short address) {
+    address &= 0x0FFF;
+    if (!(chip8->breakpoints[address >> 6] >> (address & 63) & 1)) {
+        chip8->breakpoints[address >> 6] |= 1ULL << (address & 63);
+        chip8->breakpoint_count++;
+    }
+}
+
+void clear_breakpoint(Chip8_t *chip8, unsigned short address) {
+    address &= 0x0FFF;
+    if (chip8->breakpoints[address >> 6] >> (address & 63) & 1) {
+        chip8->breakpoints[address >> 6] &= ~(1ULL << (address & 63));
+        chip8->breakpoint_count--;
+    }
+}
+
+// IdleState_t is the part of the machine a loop can carry from one iteration to the next without a side effect:
+// everything except memory, the screen and the keypad, which run_cycles never changes.
+typedef struct {
+    unsigned char V[REGISTER_SIZE];
+    unsigned short stack[STACK_SIZE];
+    unsigned short I;
+    unsigned char sp;
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+} IdleState_t;
+
+static void save_idle_state(const Chip8_t *chip8, IdleState_t *state) {
+    memset(state, 0, sizeof *state); // padding too, so that same_idle_state can compare with memcmp
+    memcpy(state->V, chip8->V, sizeof state->V);
+    memcpy(state->stack, chip8->stack, sizeof state->stack);
+    state->I = chip8->I;
+    state->sp = chip8->sp;
+    state->delay_timer = chip8->delay_timer;
+    state->sound_timer = chip8->sound_timer;
+}
+
+static int same_idle_state(const Chip8_t *chip8, const IdleState_t *state) {
+    IdleState_t now;
+    save_idle_state(chip8, &now);
+    return memcmp(&now, state, sizeof now) == 0;
+}
+
+// Wait loops (polling the delay timer with Fx07, testing a key with Ex9E/ExA1, or a bare self-jump) are found at
+// backward jumps: if the same jump comes round again with IdleState_t unchanged and no side effect in between, every
+// further pass is identical until a timer tick or key change, neither of which can happen inside run_cycles. Those
+// passes are counted but not executed, leaving less than one pass to run normally, so the machine ends up exactly
+// where running the whole budget would have left it.
+RunResult_t run_cycles(Chip8_t *chip8, int budget) {
+    RunResult_t result = {RUN_BUDGET, 0};
+    const int check_breakpoints = chip8->breakpoint_count != 0; // keeps the bitmap test out of the common loop
+    IdleState_t loop_state;
+    int loop_jump = -1; // address of the last backward jump, whose state is in loop_state
+    int loop_start = 0; // result.cycles when it executed
+
+    while (result.cycles < budget) {
+        unsigned short pc = chip8->pc & 0x0FFF; // skips may leave it one instruction past the end of memory
+
+//        the first instruction is never stopped on, so calling again after RUN_BREAKPOINT steps over it
+        if (check_breakpoints && result.cycles > 0 && (chip8->breakpoints[pc >> 6] >> (pc & 63) & 1)) {
+            result.reason = RUN_BREAKPOINT;
+            return result;
+        }
+
+        const Instruction_t *instruction = fetch_decoded(chip8, pc);
+//        a fused pair would run past the budget, or over a breakpoint on its second instruction
+        if (instruction->length > 1 && (check_breakpoints || result.cycles + 1 == budget)) {
+            instruction = &decode_table[instruction->opcode];
+        }
+        chip8->opcode = instruction->opcode;
+        PROFILE_INSTRUCTION(chip8, instruction, pc);
+        chip8->pc = (pc + 2) & 0x0FFF;
+        instruction->handler(chip8, instruction);
+        result.cycles += instruction->length;
+
+        if (instruction->handler == exec_Dxyn || instruction->handler == exec_Annn_Dxyn) {
+            result.reason = RUN_DRAW;
+            return result;
+        }
+        if (instruction->handler == exec_1nnn && instruction->nnn <= pc) {
+            if (loop_jump == pc && !chip8->side_effect && same_idle_state(chip8, &loop_state)) {
+                int pass = result.cycles - loop_start;
+                int skipped = (budget - result.cycles) / pass * pass;
+                result.cycles += skipped;
+                chip8->idle_cycles += skipped;
+#ifdef CHIP8_PROFILE
+                chip8->profile.since_draw += skipped;
+#endif
+            }
+            save_idle_state(chip8, &loop_state);
+            loop_jump = pc;
+            loop_start = result.cycles;
+            chip8->side_effect = 0;
+        }
+//        Fx0A rewinds pc while no key is down; spinning on it for the rest of the budget would be wasted work
+        if (instruction->handler == exec_Fx0A && (chip8->pc & 0x0FFF) == pc) {
+            result.reason = RUN_WAIT_KEY;
+            return result;
+        }
+    }
+
+    return result;
+}
+
+RunResult_t run_until_frame(Chip8_t *chip8) {
+    return run_cycles(chip8, CYCLES_PER_FRAME);
+}
+
+int run_frame(Chip8_t *chip8, int cycles) {
+//    draws end a run early, but the frame still gets its whole budget unless the program waits for a key
+    int remaining = cycles;
+    while (remaining > 0) {
+        RunResult_t result = run_cycles(chip8, remaining);
+        remaining -= result.cycles;
+        if (result.reason == RUN_WAIT_KEY) {
+            break;
+        }
+    }
+
+    tick_timers(chip8);
+    return cycles - remaining;
+}
+
+#if CHIP8_THREADED
+// Runs cycles instructions with threaded dispatch: the end of every handler body fetches the next instruction and
+// jumps straight to its body through a label address, so there is no central loop or call per instruction and each
+// body gets its own indirect branch for the predictor to learn.
+int run_threaded(Chip8_t *chip8, int cycles) {
+    static void *const labels[] = {
+        &&op_00E0, &&op_00EE, &&op_0nnn, &&op_1nnn, &&op_2nnn, &&op_3xkk, &&op_4xkk, &&op_5xy0, &&op_6xkk,
+        &&op_7xkk, &&op_8xy0, &&op_8xy1, &&op_8xy2, &&op_8xy3, &&op_8xy4, &&op_8xy5, &&op_8xy6, &&op_8xy7,
+        &&op_8xyE, &&op_9xy0, &&op_Annn, &&op_Bnnn, &&op_Cxkk, &&op_Dxyn, &&op_Ex9E, &&op_ExA1, &&op_Fx07,
+        &&op_Fx0A, &&op_Fx15, &&op_Fx18, &&op_Fx1E, &&op_Fx29, &&op_Fx33, &&op_Fx55, &&op_Fx65, &&op_unknown,
+        &&op_Annn_Dxyn, &&op_Annn_Fx65, &&op_6xkk_Fx29, &&op_7xkk_3xkk,
+    };
+    const Instruction_t *in;
+    int executed = 0;
+
+#define DISPATCH() \
+    do { \
+        if (executed == cycles) { \
+            return executed; \
+        } \
+        in = fetch_decoded(chip8, chip8->pc); \
+        if (in->length > cycles - executed) { \
+            in = &decode_table[in->opcode]; \
+        } \
+        executed += in->length; \
+        chip8->opcode = in->opcode; \
+        chip8->pc = (chip8->pc + 2) & 0x0FFF; \
+        goto *labels[in->kind]; \
+    } while (0)
+
+    DISPATCH();
+
+    op_00E0: opcode_00E0(chip8); DISPATCH();
+    op_00EE: opcode_00EE(chip8); DISPATCH();
+    op_0nnn: DISPATCH();
+    op_1nnn: opcode_1nnn(chip8, in->nnn); DISPATCH();
+    op_2nnn: opcode_2nnn(chip8, in->nnn); DISPATCH();
+    op_3xkk: opcode_3xkk(chip8, in->x, in->kk); DISPATCH();
+    op_4xkk: opcode_4xkk(chip8, in->x, in->kk); DISPATCH();
+    op_5xy0: opcode_5xy0(chip8, in->x, in->y); DISPATCH();
+    op_6xkk: opcode_6xkk(chip8, in->x, in->kk); DISPATCH();
+    op_7xkk: opcode_7xkk(chip8, in->x, in->kk); DISPATCH();
+    op_8xy0: opcode_8xy0(chip8, in->x, in->y); DISPATCH();
+    op_8xy1: opcode_8xy1(chip8, in->x, in->y); DISPATCH();
+    op_8xy2: opcode_8xy2(chip8, in->x, in->y); DISPATCH();
+    op_8xy3: opcode_8xy3(chip8, in->x, in->y); DISPATCH();
+    op_8xy4: opcode_8xy4(chip8, in->x, in->y); DISPATCH();
+    op_8xy5: opcode_8xy5(chip8, in->x, in->y); DISPATCH();
+    op_8xy6: opcode_8xy6(chip8, in->x); DISPATCH();
+    op_8xy7: opcode_8xy7(chip8, in->x, in->y); DISPATCH();
+    op_8xyE: opcode_8xyE(chip8, in->x); DISPATCH();
+    op_9xy0: opcode_9xy0(chip8, in->x, in->y); DISPATCH();
+    op_Annn: opcode_Annn(chip8, in->nnn); DISPATCH();
+    op_Bnnn: opcode_Bnnn(chip8, in->nnn); DISPATCH();
+    op_Cxkk: opcode_Cxkk(chip8, in->x, in->kk); DISPATCH();
+    op_Dxyn: opcode_Dxyn(chip8, in->x, in->y, in->n); DISPATCH();
+    op_Ex9E: opcode_Ex9E(chip8, in->x); DISPATCH();
+    op_ExA1: opcode_ExA1(chip8, in->x); DISPATCH();
+    op_Fx07: opcode_Fx07(chip8, in->x); DISPATCH();
+    op_Fx0A: opcode_Fx0A(chip8, in->x); DISPATCH();
+    op_Fx15: opcode_Fx15(chip8, in->x); DISPATCH();
+    op_Fx18: opcode_Fx18(chip8, in->x); DISPATCH();
+    op_Fx1E: opcode_Fx1E(chip8, in->x); DISPATCH();
+    op_Fx29: opcode_Fx29(chip8, in->x); DISPATCH();
+    op_Fx33: opcode_Fx33(chip8, in->x); DISPATCH();
+    op_Fx55: opcode_Fx55(chip8, in->x); DISPATCH();
+    op_Fx65: opcode_Fx65(chip8, in->x); DISPATCH();
+    op_unknown: exec_unknown(chip8, in); DISPATCH();
+    op_Annn_Dxyn: exec_Annn_Dxyn(chip8, in); DISPATCH();
+    op_Annn_Fx65: exec_Annn_Fx65(chip8, in); DISPATCH();
+    op_6xkk_Fx29: exec_6xkk_Fx29(chip8, in); DISPATCH();
+    op_7xkk_3xkk: exec_7xkk_3xkk(chip8, in); DISPATCH();
+
+#undef DISPATCH
+}
+#else
+// Compilers without labels-as-values get the plain loop
+int run_threaded(Chip8_t *chip8, int cycles) {
+    for (int i = 0; i < cycles; i++) {
+        emulate_cycle(chip8);
+    }
+    return cycles;
+}
+#endif
+
+// Writes the assembly form of an opcode, in the notation used by the comments above, into buffer
+void disassemble(unsigned short opcode, char *buffer, size_t size) {
+    unsigned short x = (opcode & 0x0F00) >> 8;
+    unsigned short y = (opcode & 0x00F0) >> 4;
+    unsigned short kk = opcode & 0x00FF;
+    unsigned short nnn = opcode & 0x0FFF;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00E0) {
+                snprintf(buffer, size, "CLS");
+            } else if (opcode == 0x00EE) {
+                snprintf(buffer, size, "RET");
+            } else {
+                snprintf(buffer, size, "SYS 0x%03X", nnn);
+            }
+            return;
+        case 0x1000: snprintf(buffer, size, "JP 0x%03X", nnn); return;
+        case 0x2000: snprintf(buffer, size, "CALL 0x%03X", nnn); return;
+        case 0x3000: snprintf(buffer, size, "SE V%X, 0x%02X", x, kk); return;
+        case 0x4000: snprintf(buffer, size, "SNE V%X, 0x%02X", x, kk); return;
+        case 0x5000:
+            if ((opcode & 0x000F) == 0x0000) {
+                snprintf(buffer, size, "SE V%X, V%X", x, y);
+                return;
+            }
             break;
-        case 0x7000:
-            opcode_7xkk(chip8, x, nn);
+        case 0x6000: snprintf(buffer, size, "LD V%X, 0x%02X", x, kk); return;
+        case 0x7000: snprintf(buffer, size, "ADD V%X, 0x%02X", x, kk); return;
         case 0x8000:
-            switch (chip8->opcode & 0x000F) {
-                case 0x0000:
-                    opcode_8xy0(chip8, x, y);
-                    break;
-                case 0x0001:
-                    opcode_8xy1(chip8, x, y);
-                    break;
-                case 0x0002:
-                    opcode_8xy2(chip8, x, y);
-                    break;
-                case 0x0003:
-                    opcode_8xy3(chip8, x, y);
-                    break;
-                case 0x0004:
-                    opcode_8xy4(chip8, x, y);
-                    break;
-                case 0x0005:
-                    opcode_8xy5(chip8, x, y);
-                    break;
-                case 0x0006:
-                    opcode_8xy6(chip8, x);
-                    break;
-                case 0x0007:
-                    opcode_8xy7(chip8, x, y);
-                    break;
-                case 0x000E:
-                    opcode_8xyE(chip8, x);
-                    break;
+            switch (opcode & 0x000F) {
+                case 0x0000: snprintf(buffer, size, "LD V%X, V%X", x, y); return;
+                case 0x0001: snprintf(buffer, size, "OR V%X, V%X", x, y); return;
+                case 0x0002: snprintf(buffer, size, "AND V%X, V%X", x, y); return;
+                case 0x0003: snprintf(buffer, size, "XOR V%X, V%X", x, y); return;
+                case 0x0004: snprintf(buffer, size, "ADD V%X, V%X", x, y); return;
+                case 0x0005: snprintf(buffer, size, "SUB V%X, V%X", x, y); return;
+                case 0x0006: snprintf(buffer, size, "SHR V%X", x); return;
+                case 0x0007: snprintf(buffer, size, "SUBN V%X, V%X", x, y); return;
+                case 0x000E: snprintf(buffer, size, "SHL V%X", x); return;
             }
             break;
         case 0x9000:
-            opcode_9xy0(chip8, x, y);
-            break;
-        case 0xA000:
-            opcode_Annn(chip8, nnn);
-            break;
-        case 0xB000:
-            opcode_Bnnn(chip8, nnn);
-            break;
-        case 0xC000:
-            opcode_Cxkk(chip8, x, nn);
-            break;
-        case 0xD000:
-            opcode_Dxyn(chip8, x, y, chip8->opcode&0x000F);
+            if ((opcode & 0x000F) == 0x0000) {
+                snprintf(buffer, size, "SNE V%X, V%X", x, y);
+                return;
+            }
             break;
+        case 0xA000: snprintf(buffer, size, "LD I, 0x%03X", nnn); return;
+        case 0xB000: snprintf(buffer, size, "JP V0, 0x%03X", nnn); return;
+        case 0xC000: snprintf(buffer, size, "RND V%X, 0x%02X", x, kk); return;
+        case 0xD000: snprintf(buffer, size, "DRW V%X, V%X, %d", x, y, opcode & 0x000F); return;
         case 0xE000:
-            switch (chip8->opcode & 0x00FF) {
-                case 0x009E:
-                    opcode_Ex9E(chip8, x);
-                    break;
-                case 0x00A1:
-                    opcode_ExA1(chip8, x);
-                    break;
+            switch (kk) {
+                case 0x009E: snprintf(buffer, size, "SKP V%X", x); return;
+                case 0x00A1: snprintf(buffer, size, "SKNP V%X", x); return;
             }
             break;
         case 0xF000:
-            switch (chip8->opcode & 0x00FF) {
-                case 0x0007:
-                    opcode_Fx07(chip8, x);
-                    break;
-                case 0x000A:
-                    opcode_Fx0A(chip8, x);
-                    break;
-                case 0x0015:
-                    opcode_Fx15(chip8, x);
-                    break;
-                case 0x0018:
-                    opcode_Fx18(chip8, x);
-                    break;
-                case 0x001E:
-                    opcode_Fx1E(chip8, x);
-                    break;
-                case 0x0029:
-                    opcode_Fx29(chip8, x);
-                    break;
-                case 0x0033:
-                    opcode_Fx33(chip8, x);
-                    break;
-                case 0x0055:
-                    opcode_Fx55(chip8, x);
-                    break;
-                case 0x0065:
-                    opcode_Fx65(chip8, x);
-                    break;
+            switch (kk) {
+                case 0x0007: snprintf(buffer, size, "LD V%X, DT", x); return;
+                case 0x000A: snprintf(buffer, size, "LD V%X, K", x); return;
+                case 0x0015: snprintf(buffer, size, "LD DT, V%X", x); return;
+                case 0x0018: snprintf(buffer, size, "LD ST, V%X", x); return;
+                case 0x001E: snprintf(buffer, size, "ADD I, V%X", x); return;
+                case 0x0029: snprintf(buffer, size, "LD F, V%X", x); return;
+                case 0x0033: snprintf(buffer, size, "LD B, V%X", x); return;
+                case 0x0055: snprintf(buffer, size, "LD [I], V%X", x); return;
+                case 0x0065: snprintf(buffer, size, "LD V%X, [I]", x); return;
             }
             break;
-        default:
-            printf("Unknown opcode: 0x%X\n", chip8->opcode);
+    }
+    snprintf(buffer, size, "DW 0x%04X", opcode);
+}
+
+void tick_timers(Chip8_t *chip8) {
+    if (chip8->delay_timer > 0) {
+        chip8->delay_timer--;
+    }
+    if (chip8->sound_timer > 0) {
+        chip8->sound_timer--;
+    }
+}
+
+int load_rom(Chip8_t *chip8, const char *path) {
+    FILE *rom = fopen(path, "rb");
+    if (!rom) {
+        return 0;
     }
 
-//    increment pc
-chip8->pc += 2;
+//    programs start at 0x200 and may fill the rest of memory; anything longer is an error rather than truncated
+    size_t size = fread(&chip8->memory[0x200], 1, MEMORY_SIZE - 0x200, rom);
+    int too_long = fgetc(rom) != EOF;
+    fclose(rom);
+    if (size == 0 || too_long) {
+        return 0;
+    }
 
+    flush_decode_cache(chip8);
+    return 1;
 }
 
 void init_chip8(Chip8_t *chip8) {
+    build_decode_table();
+
     chip8->opcode = 0; // reset opcode
     chip8->pc = 0x200; // program counter starts at 0x200
     chip8->I = 0; // reset index register
     chip8->sp = 0; // reset stack pointer
 
 //    clear display
-    for (int i = 0; i < 2048; i++) {
+    for (int i = 0; i < SCREEN_HEIGHT; i++) {
         chip8->gfx[i] = 0;
     }
+    chip8->dirty_rows = 0xFFFFFFFF;
 
 //    clear stack
     for (int i = 0; i < 16; i++) {
@@ -472,7 +1202,39 @@ void init_chip8(Chip8_t *chip8) {
         chip8->memory[i] = fontset[i];
     }
 
+//    nothing has been decoded or translated from the new memory yet
+    for (int cache = 0; cache < CODE_CACHES; cache++) {
+        chip8->code_pages[cache] = 0;
+        chip8->written_code_pages[cache] = 0;
+    }
+    flush_decode_cache(chip8);
+
 //    reset timers
     chip8->delay_timer = 0;
     chip8->sound_timer = 0;
+
+//    clear breakpoints
+    for (int i = 0; i < MEMORY_SIZE / 64; i++) {
+        chip8->breakpoints[i] = 0;
+    }
+    chip8->breakpoint_count = 0;
+
+//    reset fusion counters
+    for (int i = 0; i < FUSION_KINDS; i++) {
+        chip8->fusion_count[i] = 0;
+    }
+
+    seed_random(chip8, CHIP8_RANDOM_SEED);
+
+//    reset idle loop detection
+    chip8->side_effect = 0;
+    chip8->idle_cycles = 0;
+
+//    reset unknown opcode count
+    chip8->unknown_opcodes = 0;
+    chip8->last_unknown = 0;
+
+#ifdef CHIP8_PROFILE
+    memset(&chip8->profile, 0, sizeof chip8->profile);
+#endif
 }
\ No newline at end of file
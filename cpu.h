@@ -4,29 +4,151 @@
 
 #ifndef CHIP_8_CPU_H
 #define CHIP_8_CPU_H
+#include <stddef.h>
+#include <stdint.h>
 #define MEMORY_SIZE 4096
+#define MEMORY_PAGE_SIZE 256 // granularity of dirty_pages
+#define MEMORY_PAGES (MEMORY_SIZE / MEMORY_PAGE_SIZE)
 #define REGISTER_SIZE 16
 #define STACK_SIZE 16
 #define SCREEN_WIDTH 64
 #define SCREEN_HEIGHT 32
+#define CYCLES_PER_FRAME 11 // default instructions per 60 Hz frame, about 660 Hz
+#define CHIP8_RANDOM_SEED 0x2545F491u // Cxkk's sequence after init_chip8, the same on every run
 
+typedef struct Chip8 Chip8_t;
+typedef struct Instruction Instruction_t;
 
+// OpcodeHandler_t executes one decoded instruction against the machine
+typedef void (*OpcodeHandler_t)(Chip8_t *chip8, const Instruction_t *instruction);
+
+// Instruction_t is a decoded opcode: the handler to run plus its pre-extracted operands
+struct Instruction {
+    OpcodeHandler_t handler;
+    unsigned short nnn; // lowest 12 bits (address)
+    unsigned char x; // lower 4 bits of the high byte
+    unsigned char y; // upper 4 bits of the low byte
+    unsigned char kk; // lowest 8 bits
+    unsigned char n; // lowest 4 bits
+    unsigned short opcode; // the raw opcode this was decoded from (the first one, for a fused pair)
+    unsigned char length; // instructions executed by handler: 1, or 2 for a fused pair (see fuse_instruction)
+    unsigned char kind; // index of handler in the dispatch order used by run_threaded
+};
+
+// Opcode pairs that are fused into a single decoded instruction, in the order fusion_count counts them
+enum {
+    FUSE_ANNN_DXYN, // set I then draw the sprite it points at
+    FUSE_ANNN_FX65, // set I then load registers from it
+    FUSE_6XKK_FX29, // load a digit then point I at its font sprite
+    FUSE_7XKK_3XKK, // loop counter increment then test
+    FUSION_KINDS
+};
+
+// CodeCache_t is a cache of translated code that can follow a machine. Each has its own pair of page masks in
+// Chip8_t, so that one engine picking up the pages written since it last looked leaves the others theirs to pick up,
+// and engines can take turns on one machine.
+typedef enum {
+    CODE_CACHE_BLOCKS, // BlockCache_t, see block.h
+    CODE_CACHE_JIT, // Jit_t, see jit.h
+    CODE_CACHE_AOT, // a ROM recompiled by chip8-aot
+    CODE_CACHES
+} CodeCache_t;
+
+#ifdef CHIP8_PROFILE
+#define PROFILE_KINDS 40 // handler kinds, including the fused pairs (see handler_kinds in cpu.c)
+#define PROFILE_DRAW_BUCKETS 16 // gaps between draws, bucketed by powers of two
+#define PROFILE_HOT_ADDRESSES 20 // addresses disassembled by print_profile
+
+// Profile_t is a struct that contains the execution counts gathered by emulate_cycle and run_cycles when built with
+// CHIP8_PROFILE. Without it the counting is compiled out and Chip8_t doesn't have one. See print_profile.
 typedef struct {
-    unsigned char opcode; // 2 byte opcode
+    unsigned long long kind_count[PROFILE_KINDS]; // executions of each handler
+    unsigned long long pc_count[MEMORY_SIZE]; // executions of the instruction at each address
+    unsigned long long draw_gaps[PROFILE_DRAW_BUCKETS]; // bucket b counts gaps of 2^b up to 2^(b+1)-1 instructions
+    unsigned long long since_draw; // instructions since the last Dxyn
+} Profile_t;
+#endif
+
+struct Chip8 {
+    unsigned short opcode; // 2 byte opcode
     unsigned char memory[MEMORY_SIZE]; // 4k memory
     unsigned char V [REGISTER_SIZE]; // 16 registers
     unsigned short stack[STACK_SIZE]; // A stack with 16 levels
     unsigned char sp; // stack pointer
-    unsigned char gfx [SCREEN_WIDTH * SCREEN_HEIGHT]; // graphics
+    uint64_t gfx[SCREEN_HEIGHT]; // graphics, one word per row with the leftmost pixel in the top bit; see get_pixel
     unsigned char delay_timer;
     unsigned char sound_timer;
     unsigned short I; // index register
     unsigned short pc; // program counter
     unsigned char keypad[16];
     int draw_flag;
-} Chip8_t;
+    uint32_t dirty_rows; // bit y is set when gfx[y] may have changed; whoever displays the screen clears it
+    Instruction_t decoded[MEMORY_SIZE]; // decode cache keyed by address, filled the first time each one executes
+    unsigned long long code_pages[CODE_CACHES]; // one bit per 64-byte page holding each cache's translated code
+    unsigned long long written_code_pages[CODE_CACHES]; // pages from code_pages that a store has written to since
+                                                        // that cache last checked; only it clears them
+    unsigned long long breakpoints[MEMORY_SIZE / 64]; // one bit per address, see set_breakpoint
+    int breakpoint_count;
+    unsigned long long fusion_count[FUSION_KINDS]; // times each fused pair has executed, see print_fusion_stats
+    int side_effect; // set by anything idle detection can't see in registers: memory stores, Cxkk and unknown
+                     // opcodes (see run_cycles)
+    unsigned long long idle_cycles; // instructions run_cycles has skipped over in wait loops
+    unsigned long long unknown_opcodes; // instructions that decode to nothing, run as no-ops; frontends report them
+    unsigned short last_unknown; // the most recent of them
+    uint32_t random_state; // xorshift32 state for Cxkk, so machines on different threads don't share rand()
+    unsigned int page_stores[MEMORY_PAGES]; // stores into each 256-byte page so far, wrapping; see dirty_pages
+#ifdef CHIP8_PROFILE
+    Profile_t profile;
+#endif
+};
+
+// RunExit_t is why run_cycles returned
+typedef enum {
+    RUN_BUDGET, // executed the whole budget
+    RUN_DRAW, // the last instruction was Dxyn, so the screen may have changed
+    RUN_WAIT_KEY, // Fx0A is waiting for a key; pc still points at it
+    RUN_BREAKPOINT, // pc is at a breakpoint that has not executed yet
+} RunExit_t;
+
+// RunResult_t is what run_cycles returns: the exit reason and how many instructions were executed
+typedef struct {
+    RunExit_t reason;
+    int cycles;
+} RunResult_t;
 
 void emulate_cycle(Chip8_t *chip8);
-void init_chip8(Chip8_t *chip8);
+RunResult_t run_cycles(Chip8_t *chip8, int budget); // runs up to budget instructions, stopping early on draws, key waits and breakpoints
+                                                    // and skipping through loops that only wait on a timer or key
+RunResult_t run_until_frame(Chip8_t *chip8); // run_cycles with one frame's worth of instructions
+void tick_timers(Chip8_t *chip8); // counts both timers down by one; call at 60 Hz
+int run_frame(Chip8_t *chip8, int cycles); // one 60 Hz frame: cycles instructions through run_cycles, then tick_timers;
+                                           // returns how many ran, fewer than cycles if Fx0A is waiting for a key
+void set_breakpoint(Chip8_t *chip8, unsigned short address);
+void clear_breakpoint(Chip8_t *chip8, unsigned short address);
+int run_threaded(Chip8_t *chip8, int cycles); // runs exactly cycles instructions, same result as emulate_cycle
+void init_chip8(Chip8_t *chip8); // the first call also builds tables shared by every machine; make it before starting threads
+void seed_random(Chip8_t *chip8, uint32_t seed); // init_chip8 seeds with CHIP8_RANDOM_SEED
+int load_rom(Chip8_t *chip8, const char *path); // loads at 0x200 after init_chip8; returns 0 if unreadable or too big
+void flush_decode_cache(Chip8_t *chip8); // call after writing memory[] directly, e.g. when loading a ROM
+uint16_t dirty_pages(const Chip8_t *chip8, unsigned int seen[MEMORY_PAGES]); // bit p set if page p may have
+                                                                             // changed since seen was last updated
+const Instruction_t *decode_at(Chip8_t *chip8, unsigned short address); // never a fused pair
+void print_fusion_stats(const Chip8_t *chip8);
+#ifdef CHIP8_PROFILE
+void print_profile(const Chip8_t *chip8); // opcode histogram, gaps between draws and the hottest addresses
+#endif
+void disassemble(unsigned short opcode, char *buffer, size_t size);
+int get_pixel(const Chip8_t *chip8, int x, int y); // 1 if the pixel at column x, row y is on
+
+// Opcode handlers, for code that executes instructions without going through emulate_cycle (see aot.c)
+void opcode_00E0(Chip8_t *chip8);
+void opcode_00EE(Chip8_t *chip8);
+void opcode_Cxkk(Chip8_t *chip8, unsigned short x, unsigned short kk);
+void opcode_Dxyn(Chip8_t *chip8, unsigned short x, unsigned short y, unsigned short n);
+void opcode_Dxyn_scalar(Chip8_t *chip8, unsigned short x, unsigned short y, unsigned short n); // never vectorised
+void opcode_Fx0A(Chip8_t *chip8, unsigned short x);
+void opcode_Fx33(Chip8_t *chip8, unsigned short x);
+void opcode_Fx55(Chip8_t *chip8, unsigned short x);
+void opcode_Fx65(Chip8_t *chip8, unsigned short x);
 
 #endif //CHIP_8_CPU_H
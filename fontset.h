@@ -2,23 +2,6 @@
 #define CHIP_8_FONTSET_H
 #define FONTSET_SIZE 80
 
-#endif //CHIP_8_FONTSET_H
+extern const unsigned char fontset[FONTSET_SIZE]; // 4x5 sprites for the hex digits 0-F, loaded at address 0
 
-const unsigned char fontset[FONTSET_SIZE] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0,		    // 0
-        0x20, 0x60, 0x20, 0x20, 0x70,		    // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0,		    // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0,		    // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10,		// 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0,		// 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0,		// 6
-        0xF0, 0x10, 0x20, 0x40, 0x40,		// 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0,		// 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0,		// 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90,		// A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0,		// B
-        0xF0, 0x80, 0x80, 0x80, 0xF0,		// C
-        0xE0, 0x90, 0x90, 0x90, 0xE0,		// D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0,		// E
-        0xF0, 0x80, 0xF0, 0x80, 0x80		    // F
-};
\ No newline at end of file
+#endif //CHIP_8_FONTSET_H
@@ -0,0 +1,33 @@
+#include "frame.h"
+
+void init_frame_exchange(FrameExchange_t *exchange) {
+    for (int i = 0; i < 3; i++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            exchange->frames[i].gfx[y] = 0;
+        }
+        exchange->frames[i].number = 0;
+    }
+    exchange->back = 0;
+    atomic_init(&exchange->latest, 1);
+    exchange->front = 2;
+}
+
+Frame_t *back_frame(FrameExchange_t *exchange) {
+    return &exchange->frames[exchange->back];
+}
+
+void publish_frame(FrameExchange_t *exchange) {
+//    release makes the finished frame visible before its index; acquire hands back a frame the consumer is done with
+    int previous = atomic_exchange_explicit(&exchange->latest, exchange->back | FRAME_FRESH, memory_order_acq_rel);
+    exchange->back = previous & ~FRAME_FRESH;
+}
+
+const Frame_t *take_frame(FrameExchange_t *exchange) {
+    if (!(atomic_load_explicit(&exchange->latest, memory_order_relaxed) & FRAME_FRESH)) {
+        return NULL;
+    }
+
+    int latest = atomic_exchange_explicit(&exchange->latest, exchange->front, memory_order_acq_rel);
+    exchange->front = latest & ~FRAME_FRESH;
+    return &exchange->frames[exchange->front];
+}
@@ -0,0 +1,31 @@
+#ifndef CHIP_8_FRAME_H
+#define CHIP_8_FRAME_H
+#include <stdatomic.h>
+#include <stdint.h>
+#include "cpu.h"
+
+#define FRAME_FRESH 4 // set in FrameExchange_t::latest until the consumer takes the frame it points at
+
+// Frame_t is a finished screen handed from the emulation thread to the thread that displays it
+typedef struct {
+    uint64_t gfx[SCREEN_HEIGHT];
+    unsigned long long number; // frames emulated when this one was published
+} Frame_t;
+
+// FrameExchange_t is a lock-free triple buffer between one producer and one consumer. The producer always owns one
+// frame to draw into and the consumer one to read from; the third is the latest published frame. Publishing and
+// taking each swap their own frame with that one in a single atomic exchange, so neither side ever waits, the
+// consumer always gets the newest frame, and frames it was too slow for are simply skipped.
+typedef struct {
+    Frame_t frames[3];
+    atomic_int latest; // index of the latest published frame, plus FRAME_FRESH if it has not been taken yet
+    int back; // owned by the producer
+    int front; // owned by the consumer
+} FrameExchange_t;
+
+void init_frame_exchange(FrameExchange_t *exchange);
+Frame_t *back_frame(FrameExchange_t *exchange); // the frame the producer fills before calling publish_frame
+void publish_frame(FrameExchange_t *exchange);
+const Frame_t *take_frame(FrameExchange_t *exchange); // the newest frame if one was published since the last call
+
+#endif //CHIP_8_FRAME_H
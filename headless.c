@@ -0,0 +1,120 @@
+// chip8-headless: runs a ROM with no window, as fast as the host allows, and prints the final machine state.
+//
+//   chip8-headless [--jit] [--ipf instructions per frame] [--frames frames] [--load state] [--save state] rom.ch8
+//
+// Frames are emulated back to back rather than paced at 60 Hz, with the timers ticking once per frame as usual, so
+// the result is the same as the SDL frontend with no keys pressed. --load starts from a save state (see savestate.h)
+// instead of the ROM's first instruction, and --save writes one when the last frame has run.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu.h"
+#include "jit.h"
+#include "savestate.h"
+
+#define DEFAULT_FRAMES 600 // ten seconds of emulated time
+
+// Prints the registers, timers and screen, one character per pixel
+void print_machine(const Chip8_t *chip8) {
+    for (int i = 0; i < REGISTER_SIZE; i++) {
+        printf("V%X=%02X ", i, chip8->V[i]);
+    }
+    printf("I=%03X PC=%03X SP=%X DT=%02X ST=%02X\n", chip8->I, chip8->pc, chip8->sp, chip8->delay_timer,
+           chip8->sound_timer);
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        char row[SCREEN_WIDTH + 1];
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            row[x] = get_pixel(chip8, x, y) ? '#' : '.';
+        }
+        row[SCREEN_WIDTH] = '\0';
+        puts(row);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *rom_path = NULL;
+    const char *load_path = NULL;
+    const char *save_path = NULL;
+    int use_jit = 0;
+    int cycles_per_frame = CYCLES_PER_FRAME;
+    long frames = DEFAULT_FRAMES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            use_jit = 1;
+        } else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+            cycles_per_frame = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            load_path = argv[++i];
+        } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else {
+            rom_path = argv[i];
+        }
+    }
+    if (!rom_path || cycles_per_frame < 1 || frames < 0) {
+        fprintf(stderr, "usage: %s [--jit] [--ipf instructions per frame] [--frames frames] [--load state] "
+                        "[--save state] rom.ch8\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    static Chip8_t chip8;
+    init_chip8(&chip8);
+    if (!load_rom(&chip8, rom_path)) {
+        fprintf(stderr, "Unable to load ROM: %s\n", rom_path);
+        return EXIT_FAILURE;
+    }
+    if (load_path && !load_state_file(&chip8, load_path)) {
+        fprintf(stderr, "Unable to load state: %s\n", load_path);
+        return EXIT_FAILURE;
+    }
+
+    Jit_t *jit = NULL;
+    if (use_jit) {
+        jit = malloc(sizeof *jit);
+        if (jit && init_jit(jit)) {
+            flush_jit(jit, &chip8);
+        } else {
+            fprintf(stderr, "JIT unavailable, using the interpreter\n");
+            free(jit);
+            jit = NULL;
+        }
+    }
+
+    clock_t start = clock();
+    for (long frame = 0; frame < frames; frame++) {
+        if (jit) {
+            run_jit(jit, &chip8, cycles_per_frame);
+            tick_timers(&chip8);
+        } else {
+            run_frame(&chip8, cycles_per_frame);
+        }
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    print_machine(&chip8);
+    if (chip8.unknown_opcodes) {
+        fprintf(stderr, "%llu unknown opcodes run, the last 0x%04X\n", chip8.unknown_opcodes, chip8.last_unknown);
+    }
+#ifdef CHIP8_PROFILE
+    print_profile(&chip8);
+#endif
+    printf("%ld frames in %.3f s", frames, seconds);
+    if (seconds > 0) {
+        printf(", %.0fx real time", (double)frames / 60.0 / seconds);
+    }
+    printf("\n");
+
+    if (save_path && !save_state_file(&chip8, save_path)) {
+        fprintf(stderr, "Unable to save state: %s\n", save_path);
+    }
+
+    if (jit) {
+        destroy_jit(jit);
+        free(jit);
+    }
+    return EXIT_SUCCESS;
+}
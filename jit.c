@@ -0,0 +1,615 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS and sysconf under -std=c17
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include "jit.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_SUPPORTED 1
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+#if JIT_SUPPORTED
+
+// x86-64 register numbers used by the emitter
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3 // holds the Chip8_t pointer for the whole block
+#define RSI 6
+#define RDI 7
+
+// V registers are cached in r8-r15 for the length of a block
+#define POOL_SIZE 8
+#define POOL_BASE 8
+
+// Worst case native code for one instruction, used to check the arena has room before compiling a block
+#define MAX_CODE_PER_OP 128
+
+#ifdef _WIN32
+#define ARG0 RCX
+#define ARG1 RDX
+#else
+#define ARG0 RDI
+#define ARG1 RSI
+#endif
+
+#define OFF_V ((int)offsetof(Chip8_t, V))
+#define OFF_PC ((int)offsetof(Chip8_t, pc))
+#define OFF_I ((int)offsetof(Chip8_t, I))
+#define OFF_OPCODE ((int)offsetof(Chip8_t, opcode))
+#define OFF_DELAY ((int)offsetof(Chip8_t, delay_timer))
+#define OFF_SOUND ((int)offsetof(Chip8_t, sound_timer))
+
+// Emitter_t is the state of one block being compiled: the output position and which V register lives in which
+// host register. A cached V is "dirty" once the block has changed it and it must be written back.
+typedef struct {
+    unsigned char *code;
+    size_t length;
+    int host_of[REGISTER_SIZE]; // host register caching each V, or -1
+    int dirty[REGISTER_SIZE];
+    int guest_of[POOL_SIZE]; // V cached in each pool register, or -1
+    int pinned; // pool registers the current instruction is using and that must not be evicted
+    int next_victim;
+} Emitter_t;
+
+static void emit8(Emitter_t *e, unsigned char byte) {
+    e->code[e->length++] = byte;
+}
+
+static void emit16(Emitter_t *e, unsigned short value) {
+    emit8(e, value & 0xFF);
+    emit8(e, value >> 8);
+}
+
+static void emit32(Emitter_t *e, unsigned int value) {
+    emit16(e, value & 0xFFFF);
+    emit16(e, value >> 16);
+}
+
+static void emit64(Emitter_t *e, unsigned long long value) {
+    emit32(e, value & 0xFFFFFFFF);
+    emit32(e, value >> 32);
+}
+
+// REX prefix, only emitted when one of its bits is needed. The byte registers used here are al, cl, dl and
+// r8b-r15b, so a REX prefix never turns one into spl/bpl/sil/dil.
+static void emit_rex(Emitter_t *e, int w, int reg, int rm) {
+    unsigned char rex = 0x40 | (w << 3) | ((reg >= 8) << 2) | (rm >= 8);
+    if (rex != 0x40) {
+        emit8(e, rex);
+    }
+}
+
+// ModRM for [rbx + disp32]
+static void emit_mem(Emitter_t *e, int reg, int disp) {
+    emit8(e, 0x80 | ((reg & 7) << 3) | RBX);
+    emit32(e, (unsigned int)disp);
+}
+
+// ModRM for a register to register operation
+static void emit_regs(Emitter_t *e, int reg, int rm) {
+    emit8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// movzx reg32, byte [rbx + disp]
+static void emit_load8(Emitter_t *e, int reg, int disp) {
+    emit_rex(e, 0, reg, 0);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_mem(e, reg, disp);
+}
+
+// mov byte [rbx + disp], reg8
+static void emit_store8(Emitter_t *e, int reg, int disp) {
+    emit_rex(e, 0, reg, 0);
+    emit8(e, 0x88);
+    emit_mem(e, reg, disp);
+}
+
+// mov word [rbx + disp], imm16
+static void emit_store16_imm(Emitter_t *e, int disp, unsigned short value) {
+    emit8(e, 0x66);
+    emit8(e, 0xC7);
+    emit_mem(e, 0, disp);
+    emit16(e, value);
+}
+
+// <op> dst8, src8 where op is the ModRM opcode: 0x88 mov, 0x08 or, 0x20 and, 0x30 xor, 0x00 add, 0x28 sub, 0x38 cmp
+static void emit_alu8(Emitter_t *e, unsigned char op, int dst, int src) {
+    emit_rex(e, 0, src, dst);
+    emit8(e, op);
+    emit_regs(e, src, dst);
+}
+
+// <op> dst8, imm8 where op is the /digit of opcode 0x80: 0 add, 7 cmp
+static void emit_alu8_imm(Emitter_t *e, int op, int dst, unsigned char value) {
+    emit_rex(e, 0, 0, dst);
+    emit8(e, 0x80);
+    emit_regs(e, op, dst);
+    emit8(e, value);
+}
+
+// mov dst8, imm8
+static void emit_mov8_imm(Emitter_t *e, int dst, unsigned char value) {
+    emit_rex(e, 0, 0, dst);
+    emit8(e, 0xB0 + (dst & 7));
+    emit8(e, value);
+}
+
+// shr/shl dst8, 1 where op is the /digit of opcode 0xD0: 5 shr, 4 shl
+static void emit_shift8(Emitter_t *e, int op, int dst) {
+    emit_rex(e, 0, 0, dst);
+    emit8(e, 0xD0);
+    emit_regs(e, op, dst);
+}
+
+// setcc dst8 where cc is the second opcode byte: 0x92 setc, 0x93 setnc
+static void emit_setcc(Emitter_t *e, unsigned char cc, int dst) {
+    emit_rex(e, 0, 0, dst);
+    emit8(e, 0x0F);
+    emit8(e, cc);
+    emit_regs(e, 0, dst);
+}
+
+// movzx eax, src8
+static void emit_movzx_eax(Emitter_t *e, int src) {
+    emit_rex(e, 0, 0, src);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_regs(e, RAX, src);
+}
+
+static void emit_prologue(Emitter_t *e) {
+    emit8(e, 0x53); // push rbx
+    emit8(e, 0x41); emit8(e, 0x54); // push r12
+    emit8(e, 0x41); emit8(e, 0x55); // push r13
+    emit8(e, 0x41); emit8(e, 0x56); // push r14
+    emit8(e, 0x41); emit8(e, 0x57); // push r15
+    emit8(e, 0x48); emit8(e, 0x89); emit_regs(e, ARG0, RBX); // mov rbx, chip8
+#ifdef _WIN32
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x20); // sub rsp, 32 (shadow space)
+#endif
+}
+
+static void emit_epilogue(Emitter_t *e) {
+#ifdef _WIN32
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x20); // add rsp, 32
+#endif
+    emit8(e, 0x41); emit8(e, 0x5F); // pop r15
+    emit8(e, 0x41); emit8(e, 0x5E); // pop r14
+    emit8(e, 0x41); emit8(e, 0x5D); // pop r13
+    emit8(e, 0x41); emit8(e, 0x5C); // pop r12
+    emit8(e, 0x5B); // pop rbx
+    emit8(e, 0xC3); // ret
+}
+
+// Writes every changed V back to the machine. With forget set the cache is emptied as well, which is needed before
+// calling a C handler: it may read or write V, and r8-r11 do not survive the call.
+static void write_back(Emitter_t *e, int forget) {
+    for (int slot = 0; slot < POOL_SIZE; slot++) {
+        int v = e->guest_of[slot];
+        if (v < 0) {
+            continue;
+        }
+        if (e->dirty[v]) {
+            emit_store8(e, POOL_BASE + slot, OFF_V + v);
+            e->dirty[v] = 0;
+        }
+        if (forget) {
+            e->host_of[v] = -1;
+            e->guest_of[slot] = -1;
+        }
+    }
+}
+
+// Returns the host register caching V[v], assigning one if needed. load is 0 when the instruction overwrites V[v]
+// without reading it. The register stays pinned until the next instruction.
+static int get_reg(Emitter_t *e, int v, int load) {
+    int slot = e->host_of[v];
+    if (slot < 0) {
+        for (int i = 0; i < POOL_SIZE && slot < 0; i++) {
+            if (e->guest_of[i] < 0) {
+                slot = i;
+            }
+        }
+
+        while (slot < 0) {
+            int victim = e->next_victim;
+            e->next_victim = (e->next_victim + 1) % POOL_SIZE;
+            if (e->pinned & (1 << victim)) {
+                continue;
+            }
+
+            int old = e->guest_of[victim];
+            if (e->dirty[old]) {
+                emit_store8(e, POOL_BASE + victim, OFF_V + old);
+                e->dirty[old] = 0;
+            }
+            e->host_of[old] = -1;
+            slot = victim;
+        }
+
+        e->guest_of[slot] = v;
+        e->host_of[v] = slot;
+        e->dirty[v] = 0;
+        if (load) {
+            emit_load8(e, POOL_BASE + slot, OFF_V + v);
+        }
+    }
+
+    e->pinned |= 1 << slot;
+    return POOL_BASE + slot;
+}
+
+// Calls the instruction's C handler exactly like emulate_cycle would: pc already past it and opcode set.
+static void emit_call_handler(Emitter_t *e, const Instruction_t *instruction, unsigned short next_pc) {
+    write_back(e, 1);
+    emit_store16_imm(e, OFF_PC, next_pc);
+    emit_store16_imm(e, OFF_OPCODE, instruction->opcode);
+    emit8(e, 0x48); emit8(e, 0x89); emit_regs(e, RBX, ARG0); // mov arg0, rbx
+    emit_rex(e, 1, 0, ARG1); emit8(e, 0xB8 + (ARG1 & 7)); emit64(e, (uintptr_t)instruction); // mov arg1, imm64
+    emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (uintptr_t)instruction->handler); // mov rax, imm64
+    emit8(e, 0xFF); emit8(e, 0xD0); // call rax
+}
+
+// Ends a block on a conditional skip. The comparison has already set the flags; skip_jcc is the jcc opcode that
+// jumps over the taken path (0x74 je, 0x75 jne). mov does not touch the flags, so write-back can go in between.
+static void emit_skip(Emitter_t *e, const Instruction_t *in, unsigned char skip_jcc, unsigned short next_pc) {
+    write_back(e, 0);
+    emit_store16_imm(e, OFF_OPCODE, in->opcode);
+    emit_store16_imm(e, OFF_PC, next_pc);
+    emit8(e, skip_jcc);
+    emit8(e, 9); // length of the store below
+    emit_store16_imm(e, OFF_PC, next_pc + 2);
+}
+
+// Sets VF from a flag already in al or cl, after Vx has been written like the C handlers do
+static void emit_set_vf(Emitter_t *e, int flag_reg) {
+    int vf = get_reg(e, 0x0F, 0);
+    emit_alu8(e, 0x88, vf, flag_reg);
+    e->dirty[0x0F] = 1;
+}
+
+// Emits one instruction. Returns 1 if it left pc set (a jump, skip or C handler), 0 if it just fell through.
+static int emit_instruction(Emitter_t *e, const Instruction_t *in, unsigned short next_pc) {
+    int vx, vy;
+    e->pinned = 0;
+
+    switch (in->opcode & 0xF000) {
+        case 0x1000:
+            write_back(e, 0);
+            emit_store16_imm(e, OFF_OPCODE, in->opcode);
+            emit_store16_imm(e, OFF_PC, in->nnn);
+            return 1;
+        case 0x3000:
+            emit_alu8_imm(e, 7, get_reg(e, in->x, 1), in->kk);
+            emit_skip(e, in, 0x75, next_pc);
+            return 1;
+        case 0x4000:
+            emit_alu8_imm(e, 7, get_reg(e, in->x, 1), in->kk);
+            emit_skip(e, in, 0x74, next_pc);
+            return 1;
+        case 0x5000:
+        case 0x9000:
+            if (in->n != 0) {
+                break;
+            }
+            vx = get_reg(e, in->x, 1);
+            vy = get_reg(e, in->y, 1);
+            emit_alu8(e, 0x38, vx, vy);
+            emit_skip(e, in, (in->opcode & 0xF000) == 0x5000 ? 0x75 : 0x74, next_pc);
+            return 1;
+        case 0x6000:
+            emit_mov8_imm(e, get_reg(e, in->x, 0), in->kk);
+            e->dirty[in->x] = 1;
+            return 0;
+        case 0x7000:
+            emit_alu8_imm(e, 0, get_reg(e, in->x, 1), in->kk);
+            e->dirty[in->x] = 1;
+            return 0;
+        case 0x8000:
+            vx = get_reg(e, in->x, 1);
+            vy = get_reg(e, in->y, 1);
+            switch (in->n) {
+                case 0x0: emit_alu8(e, 0x88, vx, vy); break;
+                case 0x1: emit_alu8(e, 0x08, vx, vy); break;
+                case 0x2: emit_alu8(e, 0x20, vx, vy); break;
+                case 0x3: emit_alu8(e, 0x30, vx, vy); break;
+                case 0x4:
+                    emit_alu8(e, 0x00, vx, vy);
+                    emit_setcc(e, 0x92, RAX); // carry
+                    break;
+                case 0x5:
+                    emit_alu8(e, 0x28, vx, vy);
+                    emit_setcc(e, 0x93, RAX); // not borrow
+                    break;
+                case 0x6:
+                    emit_shift8(e, 5, vx);
+                    emit_setcc(e, 0x92, RAX); // bit shifted out
+                    break;
+                case 0x7:
+                    emit_alu8(e, 0x88, RAX, vy);
+                    emit_alu8(e, 0x28, RAX, vx);
+                    emit_setcc(e, 0x93, RCX); // not borrow
+                    emit_alu8(e, 0x88, vx, RAX);
+                    e->dirty[in->x] = 1;
+                    emit_set_vf(e, RCX);
+                    return 0;
+                case 0xE:
+                    emit_shift8(e, 4, vx);
+                    emit_setcc(e, 0x92, RAX); // bit shifted out
+                    break;
+                default:
+                    e->pinned = 0;
+                    emit_call_handler(e, in, next_pc);
+                    return 1;
+            }
+            e->dirty[in->x] = 1;
+            if (in->n >= 0x4) {
+                emit_set_vf(e, RAX);
+            }
+            return 0;
+        case 0xA000:
+            emit_store16_imm(e, OFF_I, in->nnn);
+            return 0;
+        case 0xF000:
+            switch (in->kk) {
+                case 0x07:
+                    emit_load8(e, get_reg(e, in->x, 0), OFF_DELAY);
+                    e->dirty[in->x] = 1;
+                    return 0;
+                case 0x15:
+                    emit_store8(e, get_reg(e, in->x, 1), OFF_DELAY);
+                    return 0;
+                case 0x18:
+                    emit_store8(e, get_reg(e, in->x, 1), OFF_SOUND);
+                    return 0;
+                case 0x1E:
+                    emit_movzx_eax(e, get_reg(e, in->x, 1));
+                    emit8(e, 0x66); emit8(e, 0x01); emit_mem(e, RAX, OFF_I); // add word [I], ax
+                    return 0;
+                case 0x29:
+                    emit_movzx_eax(e, get_reg(e, in->x, 1));
+                    emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0x80); // lea eax, [rax + rax * 4]
+                    emit8(e, 0x66); emit8(e, 0x89); emit_mem(e, RAX, OFF_I); // mov word [I], ax
+                    return 0;
+            }
+            break;
+    }
+
+    // 00E0, 00EE, 2nnn, Bnnn, Cxkk, Dxyn, Ex__, Fx0A, Fx33, Fx55, Fx65 and anything unknown
+    emit_call_handler(e, in, next_pc);
+    return ends_block(in->opcode);
+}
+
+// The arena is never writable and executable at once: it is mapped read/write, and each block's pages are made
+// read/execute once it has been emitted, and read/write again only while another block is emitted next to it
+static void *map_arena(void) {
+#ifdef _WIN32
+    return VirtualAlloc(NULL, JIT_ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void *arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return arena == MAP_FAILED ? NULL : arena;
+#endif
+}
+
+static void unmap_arena(void *arena) {
+#ifdef _WIN32
+    VirtualFree(arena, 0, MEM_RELEASE);
+#else
+    munmap(arena, JIT_ARENA_SIZE);
+#endif
+}
+
+static size_t page_size(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? (size_t)size : 4096;
+#endif
+}
+
+// Makes the whole pages holding arena bytes offset to offset + length read/write or read/execute; returns 0 if the
+// system refused
+static int protect_arena(Jit_t *jit, size_t offset, size_t length, int executable) {
+    size_t start = offset / jit->page_size * jit->page_size;
+    size_t end = (offset + length + jit->page_size - 1) / jit->page_size * jit->page_size;
+    if (end > JIT_ARENA_SIZE) {
+        end = JIT_ARENA_SIZE;
+    }
+#ifdef _WIN32
+    DWORD old;
+    if (!VirtualProtect(jit->arena + start, end - start, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &old)) {
+        return 0;
+    }
+    if (executable) {
+        FlushInstructionCache(GetCurrentProcess(), jit->arena + start, end - start);
+    }
+    return 1;
+#else
+    return mprotect(jit->arena + start, end - start, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+// Compiles the block starting at start into the arena
+static JitBlock_t *compile_block(Jit_t *jit, Chip8_t *chip8, unsigned short start) {
+    if (jit->used == JIT_MAX_BLOCKS || JIT_ARENA_SIZE - jit->arena_used < BLOCK_MAX_OPS * MAX_CODE_PER_OP) {
+        flush_jit(jit, chip8);
+    }
+
+    JitBlock_t *block = &jit->blocks[jit->used];
+    block->start = start;
+    block->count = 0;
+
+    unsigned short address = start;
+    do {
+        const Instruction_t *instruction = decode_at(chip8, address);
+        block->ops[block->count++] = *instruction;
+        address += 2;
+        if (ends_block(instruction->opcode)) {
+            break;
+        }
+    } while (block->count < BLOCK_MAX_OPS && address < MEMORY_SIZE - 1);
+    block->end = address;
+
+//    the block may share its first page with the one before it, which is read/execute by now
+    if (!protect_arena(jit, jit->arena_used, BLOCK_MAX_OPS * MAX_CODE_PER_OP, 0)) {
+        return NULL;
+    }
+    Emitter_t e = {0};
+    e.code = jit->arena + jit->arena_used;
+    for (int i = 0; i < REGISTER_SIZE; i++) {
+        e.host_of[i] = -1;
+    }
+    for (int i = 0; i < POOL_SIZE; i++) {
+        e.guest_of[i] = -1;
+    }
+
+    emit_prologue(&e);
+    int pc_written = 0;
+    for (int i = 0; i < block->count; i++) {
+        unsigned short next_pc = (start + 2 * (i + 1)) & 0x0FFF;
+        pc_written = emit_instruction(&e, &block->ops[i], next_pc);
+    }
+
+    if (!pc_written) {
+        write_back(&e, 0);
+        emit_store16_imm(&e, OFF_PC, block->end & 0x0FFF);
+        emit_store16_imm(&e, OFF_OPCODE, block->ops[block->count - 1].opcode);
+    }
+    emit_epilogue(&e);
+    if (!protect_arena(jit, jit->arena_used, e.length, 1)) {
+        return NULL;
+    }
+
+    block->code = (JitCode_t)(void *)e.code;
+    jit->arena_used += (e.length + 15) & ~(size_t)15;
+    jit->used++;
+    block->valid = 1;
+    jit->lookup[start] = block;
+    chip8->code_pages[CODE_CACHE_JIT] |= (1ULL << (start >> 6)) | (1ULL << (((block->end - 1) & 0x0FFF) >> 6));
+    return block;
+}
+
+// Drops every block living in a page that has been stored to
+static void invalidate_written_jit_blocks(Jit_t *jit, Chip8_t *chip8) {
+    unsigned long long written = chip8->written_code_pages[CODE_CACHE_JIT];
+    chip8->written_code_pages[CODE_CACHE_JIT] = 0;
+    chip8->code_pages[CODE_CACHE_JIT] = 0;
+
+    for (int i = 0; i < jit->used; i++) {
+        JitBlock_t *block = &jit->blocks[i];
+        if (!block->valid) {
+            continue;
+        }
+
+        unsigned long long pages = (1ULL << (block->start >> 6)) | (1ULL << (((block->end - 1) & 0x0FFF) >> 6));
+        if (pages & written) {
+            block->valid = 0;
+            jit->lookup[block->start] = NULL;
+        } else {
+            chip8->code_pages[CODE_CACHE_JIT] |= pages;
+        }
+    }
+}
+
+int init_jit(Jit_t *jit) {
+    jit->arena = map_arena();
+    jit->page_size = page_size();
+    jit->arena_used = 0;
+    jit->used = 0;
+    for (int i = 0; i < MEMORY_SIZE; i++) {
+        jit->lookup[i] = NULL;
+    }
+    if (!jit->arena) {
+        return 0;
+    }
+
+//    systems that forbid making written memory executable (SELinux execmem, PaX) say so here rather than mid-run
+    if (!protect_arena(jit, 0, 1, 1) || !protect_arena(jit, 0, 1, 0)) {
+        destroy_jit(jit);
+        return 0;
+    }
+    return 1;
+}
+
+void destroy_jit(Jit_t *jit) {
+    if (jit->arena) {
+        unmap_arena(jit->arena);
+        jit->arena = NULL;
+    }
+}
+
+void flush_jit(Jit_t *jit, Chip8_t *chip8) {
+    jit->arena_used = 0;
+    jit->used = 0;
+    for (int i = 0; i < MEMORY_SIZE; i++) {
+        jit->lookup[i] = NULL;
+    }
+    chip8->code_pages[CODE_CACHE_JIT] = 0;
+    chip8->written_code_pages[CODE_CACHE_JIT] = 0;
+}
+
+// Executes compiled blocks until at least cycles instructions have run and returns how many did
+int run_jit(Jit_t *jit, Chip8_t *chip8, int cycles) {
+    int executed = 0;
+
+    while (executed < cycles) {
+        if (chip8->written_code_pages[CODE_CACHE_JIT]) {
+            invalidate_written_jit_blocks(jit, chip8);
+        }
+
+        JitBlock_t *block = jit->lookup[chip8->pc & 0x0FFF];
+        if (!block) {
+            block = compile_block(jit, chip8, chip8->pc & 0x0FFF);
+        }
+        if (!block) {
+//            the system stopped letting the arena change protection: interpret instead
+            emulate_cycle(chip8);
+            executed++;
+            continue;
+        }
+
+        block->code(chip8);
+        executed += block->count;
+    }
+
+    return executed;
+}
+
+#else
+
+int init_jit(Jit_t *jit) {
+    jit->arena = NULL;
+    return 0;
+}
+
+void destroy_jit(Jit_t *jit) {
+    (void)jit;
+}
+
+void flush_jit(Jit_t *jit, Chip8_t *chip8) {
+    (void)jit;
+    (void)chip8;
+}
+
+int run_jit(Jit_t *jit, Chip8_t *chip8, int cycles) {
+    (void)jit;
+    (void)chip8;
+    (void)cycles;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef CHIP_8_JIT_H
+#define CHIP_8_JIT_H
+#include <stddef.h>
+#include "cpu.h"
+#include "block.h"
+
+#define JIT_ARENA_SIZE (4 * 1024 * 1024) // executable memory for compiled blocks
+#define JIT_MAX_BLOCKS 1024 // blocks compiled before the whole arena is flushed
+
+// JitCode_t runs one compiled block and leaves pc pointing at whatever follows it
+typedef void (*JitCode_t)(Chip8_t *chip8);
+
+// JitBlock_t is a basic block (same boundaries as block.h) compiled to native code. Instructions the compiler does
+// not handle itself call their C handler with a pointer into ops.
+typedef struct {
+    unsigned short start; // address of the first instruction
+    unsigned short end; // address just past the last instruction
+    int count; // number of instructions in the block
+    int valid;
+    JitCode_t code;
+    Instruction_t ops[BLOCK_MAX_OPS];
+} JitBlock_t;
+
+// Jit_t is the x86-64 recompiler for one machine. It is large, so allocate it rather than keeping it on the stack,
+// and call flush_jit after init_chip8 or after loading a new ROM.
+typedef struct {
+    unsigned char *arena; // read/execute where blocks have been emitted, read/write elsewhere, never both
+    size_t arena_used;
+    size_t page_size;
+    JitBlock_t blocks[JIT_MAX_BLOCKS];
+    JitBlock_t *lookup[MEMORY_SIZE]; // block starting at each address, if one has been compiled
+    int used;
+} Jit_t;
+
+int init_jit(Jit_t *jit); // returns 0 when this host can't run the JIT; use run_blocks or emulate_cycle instead
+void destroy_jit(Jit_t *jit);
+void flush_jit(Jit_t *jit, Chip8_t *chip8);
+int run_jit(Jit_t *jit, Chip8_t *chip8, int cycles);
+
+#endif //CHIP_8_JIT_H
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "lockstep.h"
+#include "fontset.h"
+
+// Each step, every active lane executes exactly one instruction. Lanes are grouped by pc (and, where their memory
+// may differ, by the opcode found there), and each group's instruction is decoded once and executed for all of its
+// lanes together: register and timer updates with AVX2 blends under a lane mask, and anything per-lane by nature
+// (draws, stores, the stack, keys, random numbers) with a loop over the group. Lanes that branch differently simply
+// form separate groups until their pcs meet again. Every lane ends up exactly where emulate_cycle would leave a
+// Chip8_t in the same state.
+
+#define ALL_LANES 0xFFFFFFFFu
+#define PAGE_BIT(address) (1ULL << (((address) & 0x0FFF) >> 6))
+
+static inline int lowest_lane(uint32_t lanes) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(lanes);
+#else
+    int lane = 0;
+    while (!(lanes >> lane & 1)) {
+        lane++;
+    }
+    return lane;
+#endif
+}
+
+static inline int count_lanes(uint32_t lanes) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(lanes);
+#else
+    int count = 0;
+    for (; lanes; lanes &= lanes - 1) {
+        count++;
+    }
+    return count;
+#endif
+}
+
+#define FOR_EACH_LANE(lane, lanes) \
+    for (uint32_t rest_ = (lanes), lane = 0; rest_ && ((lane = (uint32_t)lowest_lane(rest_)), 1); rest_ &= rest_ - 1)
+
+#if defined(__AVX2__)
+// 0xFF in the byte of every lane in lanes
+static inline __m256i byte_mask(uint32_t lanes) {
+    const __m256i spread = _mm256_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bit = _mm256_set1_epi64x((long long)0x8040201008040201ULL);
+    __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32((int)lanes), spread);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bit), bit);
+}
+
+// 0xFFFF in the word of every lane in lanes, for lanes 0-15 (half 0) or 16-31 (half 1)
+static inline __m256i word_mask(uint32_t lanes, int half) {
+    const __m256i bit = _mm256_setr_epi16(
+        0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+        0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, (short)0x8000);
+    __m256i words = _mm256_set1_epi16((short)(lanes >> (16 * half)));
+    return _mm256_cmpeq_epi16(_mm256_and_si256(words, bit), bit);
+}
+
+static inline __m256i load_lanes(const unsigned char *array) {
+    return _mm256_loadu_si256((const __m256i *)array);
+}
+
+static inline void set_bytes(unsigned char *array, uint32_t lanes, __m256i value) {
+    __m256i old = _mm256_loadu_si256((const __m256i *)array);
+    _mm256_storeu_si256((__m256i *)array, _mm256_blendv_epi8(old, value, byte_mask(lanes)));
+}
+
+// low holds lanes 0-15, high lanes 16-31
+static inline void set_words(unsigned short *array, uint32_t lanes, __m256i low, __m256i high) {
+    __m256i old_low = _mm256_loadu_si256((const __m256i *)array);
+    __m256i old_high = _mm256_loadu_si256((const __m256i *)(array + 16));
+    _mm256_storeu_si256((__m256i *)array, _mm256_blendv_epi8(old_low, low, word_mask(lanes, 0)));
+    _mm256_storeu_si256((__m256i *)(array + 16), _mm256_blendv_epi8(old_high, high, word_mask(lanes, 1)));
+}
+
+// The bytes of an array widened to words, lanes 0-15 (half 0) or 16-31 (half 1)
+static inline __m256i widen_lanes(const unsigned char *array, int half) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(array + 16 * half)));
+}
+#endif
+
+static inline void set_uniform_word(unsigned short *array, uint32_t lanes, unsigned short value) {
+#if defined(__AVX2__)
+    __m256i broadcast = _mm256_set1_epi16((short)value);
+    set_words(array, lanes, broadcast, broadcast);
+#else
+    FOR_EACH_LANE(lane, lanes) {
+        array[lane] = value;
+    }
+#endif
+}
+
+// Lanes whose pc is pc
+static uint32_t lanes_at(const Lockstep_t *lockstep, unsigned short pc) {
+#if defined(__AVX2__)
+    __m256i target = _mm256_set1_epi16((short)pc);
+    __m256i low = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)lockstep->pc), target);
+    __m256i high = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(lockstep->pc + 16)), target);
+//    packing works within 128-bit halves, leaving the lanes in the order 0-7, 16-23, 8-15, 24-31
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+    return (uint32_t)_mm256_movemask_epi8(packed);
+#else
+    uint32_t lanes = 0;
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        lanes |= (uint32_t)(lockstep->pc[lane] == pc) << lane;
+    }
+    return lanes;
+#endif
+}
+
+// Lanes where a[lane] == b[lane]
+static inline uint32_t lanes_equal(const unsigned char *a, const unsigned char *b) {
+#if defined(__AVX2__)
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(load_lanes(a), load_lanes(b)));
+#else
+    uint32_t lanes = 0;
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        lanes |= (uint32_t)(a[lane] == b[lane]) << lane;
+    }
+    return lanes;
+#endif
+}
+
+// Lanes where a[lane] == value
+static inline uint32_t lanes_equal_to(const unsigned char *a, unsigned char value) {
+#if defined(__AVX2__)
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(load_lanes(a), _mm256_set1_epi8((char)value)));
+#else
+    uint32_t lanes = 0;
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        lanes |= (uint32_t)(a[lane] == value) << lane;
+    }
+    return lanes;
+#endif
+}
+
+// 8xy_ for every lane in lanes, with VF written after Vx as in opcode_8xy4 and the rest
+static void execute_alu(Lockstep_t *lockstep, uint32_t lanes, int x, int y, int operation) {
+    unsigned char *vx = lockstep->V[x];
+    unsigned char *vy = lockstep->V[y];
+    unsigned char *vf = lockstep->V[0x0F];
+#if defined(__AVX2__)
+    const __m256i one = _mm256_set1_epi8(1);
+    __m256i a = load_lanes(vx), b = load_lanes(vy), result, flag;
+    int sets_flag = 1;
+    switch (operation) {
+        case 0x0: result = b; sets_flag = 0; break;
+        case 0x1: result = _mm256_or_si256(a, b); sets_flag = 0; break;
+        case 0x2: result = _mm256_and_si256(a, b); sets_flag = 0; break;
+        case 0x3: result = _mm256_xor_si256(a, b); sets_flag = 0; break;
+        case 0x4: {
+            result = _mm256_add_epi8(a, b);
+            flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(a, b), result), one); // saturated: carry
+        } break;
+        case 0x5: {
+            result = _mm256_sub_epi8(a, b);
+            flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), one); // a >= b
+        } break;
+        case 0x6: {
+            result = _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F));
+            flag = _mm256_and_si256(a, one);
+        } break;
+        case 0x7: {
+            result = _mm256_sub_epi8(b, a);
+            flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), one); // b >= a
+        } break;
+        case 0xE: {
+            result = _mm256_add_epi8(a, a);
+            flag = _mm256_and_si256(_mm256_srli_epi16(a, 7), one);
+        } break;
+        default: return;
+    }
+    set_bytes(vx, lanes, result);
+    if (sets_flag) {
+        set_bytes(vf, lanes, flag);
+    }
+#else
+    FOR_EACH_LANE(lane, lanes) {
+        unsigned char a = vx[lane], b = vy[lane];
+        switch (operation) {
+            case 0x0: vx[lane] = b; break;
+            case 0x1: vx[lane] = a | b; break;
+            case 0x2: vx[lane] = a & b; break;
+            case 0x3: vx[lane] = a ^ b; break;
+            case 0x4: vx[lane] = a + b; vf[lane] = a + b > 0xFF; break;
+            case 0x5: vx[lane] = a - b; vf[lane] = a >= b; break;
+            case 0x6: vx[lane] = a >> 1; vf[lane] = a & 1; break;
+            case 0x7: vx[lane] = b - a; vf[lane] = b >= a; break;
+            case 0xE: vx[lane] = a << 1; vf[lane] = a >> 7; break;
+            default: break;
+        }
+    }
+#endif
+}
+
+// Dxyn for one lane, as draw_rows_scalar
+static void draw_lane(Lockstep_t *lockstep, int lane, int x, int y, int n) {
+    unsigned int column = lockstep->V[x][lane] & (SCREEN_WIDTH - 1);
+    unsigned int row = lockstep->V[y][lane] & (SCREEN_HEIGHT - 1);
+    const unsigned char *memory = lockstep->memory[lane];
+    uint64_t *gfx = lockstep->gfx[lane];
+    uint64_t collision = 0;
+
+    for (int line = 0; line < n; line++) {
+        uint64_t sprite = (uint64_t)memory[(lockstep->I[lane] + line) & 0x0FFF] << 56;
+        sprite = (sprite >> column) | (sprite << ((SCREEN_WIDTH - column) & (SCREEN_WIDTH - 1)));
+
+        uint64_t *screen_row = &gfx[(row + line) & (SCREEN_HEIGHT - 1)];
+        collision |= *screen_row & sprite;
+        *screen_row ^= sprite;
+    }
+    lockstep->V[0x0F][lane] = collision != 0;
+}
+
+static inline void store_lane(Lockstep_t *lockstep, int lane, unsigned short address, unsigned char value) {
+    lockstep->memory[lane][address & 0x0FFF] = value;
+    lockstep->diverged_pages |= PAGE_BIT(address);
+}
+
+// Executes opcode, fetched from pc, for every lane in lanes (all of which are at pc)
+static void execute(Lockstep_t *lockstep, uint32_t lanes, unsigned short pc, unsigned short opcode) {
+    unsigned short nnn = opcode & 0x0FFF;
+    int x = (opcode & 0x0F00) >> 8;
+    int y = (opcode & 0x00F0) >> 4;
+    unsigned char kk = opcode & 0x00FF;
+    int n = opcode & 0x000F;
+    unsigned short next = (pc + 2) & 0x0FFF;
+    unsigned short skipped = (pc + 4) & 0x0FFF;
+
+    set_uniform_word(lockstep->pc, lanes, next);
+
+    switch (opcode & 0xF000) {
+        case 0x0000: {
+            if (opcode == 0x00E0) {
+                FOR_EACH_LANE(lane, lanes) {
+                    memset(lockstep->gfx[lane], 0, sizeof lockstep->gfx[lane]);
+                }
+            } else if (opcode == 0x00EE) {
+                FOR_EACH_LANE(lane, lanes) {
+                    lockstep->sp[lane] = (lockstep->sp[lane] - 1) & (STACK_SIZE - 1);
+                    lockstep->pc[lane] = lockstep->stack[lockstep->sp[lane]][lane] & 0x0FFF;
+                }
+            }
+        } break;
+        case 0x1000: set_uniform_word(lockstep->pc, lanes, nnn); break;
+        case 0x2000: {
+            FOR_EACH_LANE(lane, lanes) {
+                lockstep->stack[lockstep->sp[lane]][lane] = next;
+                lockstep->sp[lane] = (lockstep->sp[lane] + 1) & (STACK_SIZE - 1);
+            }
+            set_uniform_word(lockstep->pc, lanes, nnn);
+        } break;
+        case 0x3000: set_uniform_word(lockstep->pc, lanes & lanes_equal_to(lockstep->V[x], kk), skipped); break;
+        case 0x4000: set_uniform_word(lockstep->pc, lanes & ~lanes_equal_to(lockstep->V[x], kk), skipped); break;
+        case 0x5000: {
+            if (n == 0) {
+                set_uniform_word(lockstep->pc, lanes & lanes_equal(lockstep->V[x], lockstep->V[y]), skipped);
+            }
+        } break;
+        case 0x6000: {
+#if defined(__AVX2__)
+            set_bytes(lockstep->V[x], lanes, _mm256_set1_epi8((char)kk));
+#else
+            FOR_EACH_LANE(lane, lanes) {
+                lockstep->V[x][lane] = kk;
+            }
+#endif
+        } break;
+        case 0x7000: {
+#if defined(__AVX2__)
+            set_bytes(lockstep->V[x], lanes, _mm256_add_epi8(load_lanes(lockstep->V[x]), _mm256_set1_epi8((char)kk)));
+#else
+            FOR_EACH_LANE(lane, lanes) {
+                lockstep->V[x][lane] += kk;
+            }
+#endif
+        } break;
+        case 0x8000: execute_alu(lockstep, lanes, x, y, n); break;
+        case 0x9000: {
+            if (n == 0) {
+                set_uniform_word(lockstep->pc, lanes & ~lanes_equal(lockstep->V[x], lockstep->V[y]), skipped);
+            }
+        } break;
+        case 0xA000: set_uniform_word(lockstep->I, lanes, nnn); break;
+        case 0xB000: {
+            FOR_EACH_LANE(lane, lanes) {
+                lockstep->pc[lane] = (nnn + lockstep->V[0][lane]) & 0x0FFF;
+            }
+        } break;
+        case 0xC000: {
+            FOR_EACH_LANE(lane, lanes) {
+                uint32_t random = lockstep->random_state[lane];
+                random ^= random << 13;
+                random ^= random >> 17;
+                random ^= random << 5;
+                lockstep->random_state[lane] = random;
+                lockstep->V[x][lane] = (random >> 24) & kk;
+            }
+        } break;
+        case 0xD000: {
+            FOR_EACH_LANE(lane, lanes) {
+                draw_lane(lockstep, (int)lane, x, y, n);
+            }
+        } break;
+        case 0xE000: {
+            if (kk != 0x9E && kk != 0xA1) {
+                break;
+            }
+            uint32_t pressed = 0;
+            FOR_EACH_LANE(lane, lanes) {
+                pressed |= (uint32_t)(lockstep->keys[lane] >> (lockstep->V[x][lane] & 0x0F) & 1) << lane;
+            }
+            set_uniform_word(lockstep->pc, lanes & (kk == 0x9E ? pressed : ~pressed), skipped);
+        } break;
+        case 0xF000: {
+            switch (kk) {
+                case 0x07: {
+#if defined(__AVX2__)
+                    set_bytes(lockstep->V[x], lanes, load_lanes(lockstep->delay_timer));
+#else
+                    FOR_EACH_LANE(lane, lanes) {
+                        lockstep->V[x][lane] = lockstep->delay_timer[lane];
+                    }
+#endif
+                } break;
+                case 0x0A: {
+                    FOR_EACH_LANE(lane, lanes) {
+                        if (lockstep->keys[lane]) {
+                            lockstep->V[x][lane] = (unsigned char)lowest_lane(lockstep->keys[lane]);
+                        } else {
+                            lockstep->pc[lane] = pc; // wait here until a key is down
+                        }
+                    }
+                } break;
+                case 0x15:
+                case 0x18: {
+                    unsigned char *timer = kk == 0x15 ? lockstep->delay_timer : lockstep->sound_timer;
+#if defined(__AVX2__)
+                    set_bytes(timer, lanes, load_lanes(lockstep->V[x]));
+#else
+                    FOR_EACH_LANE(lane, lanes) {
+                        timer[lane] = lockstep->V[x][lane];
+                    }
+#endif
+                } break;
+                case 0x1E:
+                case 0x29: {
+#if defined(__AVX2__)
+                    __m256i low = widen_lanes(lockstep->V[x], 0), high = widen_lanes(lockstep->V[x], 1);
+                    if (kk == 0x1E) {
+                        low = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)lockstep->I), low);
+                        high = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)(lockstep->I + 16)), high);
+                    } else {
+                        low = _mm256_mullo_epi16(low, _mm256_set1_epi16(5));
+                        high = _mm256_mullo_epi16(high, _mm256_set1_epi16(5));
+                    }
+                    set_words(lockstep->I, lanes, low, high);
+#else
+                    FOR_EACH_LANE(lane, lanes) {
+                        unsigned short value = lockstep->V[x][lane];
+                        lockstep->I[lane] = kk == 0x1E ? lockstep->I[lane] + value : value * 5;
+                    }
+#endif
+                } break;
+                case 0x33: {
+                    FOR_EACH_LANE(lane, lanes) {
+                        unsigned char value = lockstep->V[x][lane];
+                        unsigned short I = lockstep->I[lane];
+                        store_lane(lockstep, (int)lane, I, value / 100);
+                        store_lane(lockstep, (int)lane, I + 1, (value / 10) % 10);
+                        store_lane(lockstep, (int)lane, I + 2, value % 10);
+                    }
+                } break;
+                case 0x55: {
+                    FOR_EACH_LANE(lane, lanes) {
+                        for (int i = 0; i <= x; i++) {
+                            store_lane(lockstep, (int)lane, lockstep->I[lane] + i, lockstep->V[i][lane]);
+                        }
+                    }
+                } break;
+                case 0x65: {
+                    FOR_EACH_LANE(lane, lanes) {
+                        for (int i = 0; i <= x; i++) {
+                            lockstep->V[i][lane] = lockstep->memory[lane][(lockstep->I[lane] + i) & 0x0FFF];
+                        }
+                    }
+                } break;
+                default: break;
+            }
+        } break;
+    }
+}
+
+void run_lockstep(Lockstep_t *lockstep, int cycles) {
+    for (int cycle = 0; cycle < cycles; cycle++) {
+        uint32_t pending = lockstep->active;
+        while (pending) {
+            int leader = lowest_lane(pending);
+            unsigned short pc = lockstep->pc[leader];
+            const unsigned char *memory = lockstep->memory[leader];
+            unsigned short opcode = memory[pc] << 8 | memory[(pc + 1) & 0x0FFF];
+
+            uint32_t group = lanes_at(lockstep, pc) & pending;
+//            where a lane has stored into the code, only lanes with the same opcode there share the dispatch
+            if (lockstep->diverged_pages & (PAGE_BIT(pc) | PAGE_BIT(pc + 1))) {
+                FOR_EACH_LANE(lane, group) {
+                    if (lockstep->memory[lane][pc] != memory[pc] ||
+                        lockstep->memory[lane][(pc + 1) & 0x0FFF] != memory[(pc + 1) & 0x0FFF]) {
+                        group &= ~(1u << lane);
+                    }
+                }
+            }
+
+            execute(lockstep, group, pc, opcode);
+            pending &= ~group;
+            lockstep->lane_steps += count_lanes(group);
+            lockstep->groups++;
+        }
+    }
+}
+
+void tick_lockstep_timers(Lockstep_t *lockstep) {
+#if defined(__AVX2__)
+    const __m256i one = _mm256_set1_epi8(1);
+    set_bytes(lockstep->delay_timer, ALL_LANES, _mm256_subs_epu8(load_lanes(lockstep->delay_timer), one));
+    set_bytes(lockstep->sound_timer, ALL_LANES, _mm256_subs_epu8(load_lanes(lockstep->sound_timer), one));
+#else
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        lockstep->delay_timer[lane] -= lockstep->delay_timer[lane] > 0;
+        lockstep->sound_timer[lane] -= lockstep->sound_timer[lane] > 0;
+    }
+#endif
+}
+
+// Marks every page where some active lane's memory differs from the first active lane's
+static void find_diverged_pages(Lockstep_t *lockstep) {
+    lockstep->diverged_pages = 0;
+    if (!lockstep->active) {
+        return;
+    }
+    int first = lowest_lane(lockstep->active);
+    FOR_EACH_LANE(lane, lockstep->active & ~(1u << first)) {
+        for (int page = 0; page < MEMORY_SIZE / 64; page++) {
+            if (memcmp(&lockstep->memory[lane][page * 64], &lockstep->memory[first][page * 64], 64) != 0) {
+                lockstep->diverged_pages |= 1ULL << page;
+            }
+        }
+    }
+}
+
+void init_lockstep(Lockstep_t *lockstep, int lanes) {
+    memset(lockstep, 0, sizeof *lockstep);
+    lockstep->active = lanes >= LOCKSTEP_LANES ? ALL_LANES : lanes > 0 ? (1u << lanes) - 1 : 0;
+
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        lockstep->pc[lane] = 0x200;
+        memcpy(lockstep->memory[lane], fontset, FONTSET_SIZE);
+        lockstep->random_state[lane] = CHIP8_RANDOM_SEED;
+    }
+}
+
+int load_lockstep_rom(Lockstep_t *lockstep, const char *path) {
+    FILE *rom = fopen(path, "rb");
+    if (!rom) {
+        return 0;
+    }
+
+//    the same limits as load_rom
+    static unsigned char image[MEMORY_SIZE - 0x200];
+    size_t size = fread(image, 1, sizeof image, rom);
+    int too_long = fgetc(rom) != EOF;
+    fclose(rom);
+    if (size == 0 || too_long) {
+        return 0;
+    }
+
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        memcpy(&lockstep->memory[lane][0x200], image, size);
+    }
+    find_diverged_pages(lockstep);
+    return 1;
+}
+
+void set_lane(Lockstep_t *lockstep, int lane, const Chip8_t *chip8) {
+    for (int r = 0; r < REGISTER_SIZE; r++) {
+        lockstep->V[r][lane] = chip8->V[r];
+    }
+    for (int s = 0; s < STACK_SIZE; s++) {
+        lockstep->stack[s][lane] = chip8->stack[s];
+    }
+    lockstep->delay_timer[lane] = chip8->delay_timer;
+    lockstep->sound_timer[lane] = chip8->sound_timer;
+    lockstep->sp[lane] = chip8->sp;
+    lockstep->pc[lane] = chip8->pc & 0x0FFF;
+    lockstep->I[lane] = chip8->I;
+    lockstep->keys[lane] = 0;
+    for (int k = 0; k < 16; k++) {
+        lockstep->keys[lane] |= (uint16_t)((chip8->keypad[k] != 0) << k);
+    }
+    lockstep->random_state[lane] = chip8->random_state;
+    memcpy(lockstep->memory[lane], chip8->memory, MEMORY_SIZE);
+    memcpy(lockstep->gfx[lane], chip8->gfx, sizeof lockstep->gfx[lane]);
+
+    lockstep->active |= 1u << lane;
+    find_diverged_pages(lockstep);
+}
+
+void get_lane(const Lockstep_t *lockstep, int lane, Chip8_t *chip8) {
+    for (int r = 0; r < REGISTER_SIZE; r++) {
+        chip8->V[r] = lockstep->V[r][lane];
+    }
+    for (int s = 0; s < STACK_SIZE; s++) {
+        chip8->stack[s] = lockstep->stack[s][lane];
+    }
+    chip8->delay_timer = lockstep->delay_timer[lane];
+    chip8->sound_timer = lockstep->sound_timer[lane];
+    chip8->sp = lockstep->sp[lane];
+    chip8->pc = lockstep->pc[lane];
+    chip8->I = lockstep->I[lane];
+    for (int k = 0; k < 16; k++) {
+        chip8->keypad[k] = lockstep->keys[lane] >> k & 1;
+    }
+    chip8->random_state = lockstep->random_state[lane];
+    memcpy(chip8->memory, lockstep->memory[lane], MEMORY_SIZE);
+    memcpy(chip8->gfx, lockstep->gfx[lane], sizeof chip8->gfx);
+
+//    memory was replaced wholesale, and the screen has to be shown again
+    flush_decode_cache(chip8);
+    chip8->dirty_rows = 0xFFFFFFFF;
+    chip8->draw_flag = 1;
+}
@@ -0,0 +1,41 @@
+#ifndef CHIP_8_LOCKSTEP_H
+#define CHIP_8_LOCKSTEP_H
+#include <stdint.h>
+#include "cpu.h"
+
+#define LOCKSTEP_LANES 32 // machines per Lockstep_t: one byte each in an AVX2 register, one bit each in a lane mask
+
+// Lockstep_t runs up to LOCKSTEP_LANES machines side by side, stored as structure-of-arrays: each register is an
+// array with one entry per lane, so an instruction that several lanes are about to execute can update all of them
+// with a few vector operations. It is meant for many copies of one ROM (fuzzing inputs or random seeds, searching),
+// where the machines spend most of their time at the same pc; lanes that branch apart are run group by group, so a
+// ROM that scatters them (maze.ch8 with per-lane seeds) is slower here than separate machines. The vector paths need
+// __AVX2__ (PROFILE=native on an AVX2 host); otherwise every operation is a loop over the lanes. It is large, so
+// allocate it rather than keeping it on the stack.
+typedef struct {
+    unsigned char V[REGISTER_SIZE][LOCKSTEP_LANES]; // V[r][lane]
+    unsigned char delay_timer[LOCKSTEP_LANES];
+    unsigned char sound_timer[LOCKSTEP_LANES];
+    unsigned char sp[LOCKSTEP_LANES];
+    unsigned short pc[LOCKSTEP_LANES]; // always within memory, unlike Chip8_t where a skip can leave it at 0x1000
+    unsigned short I[LOCKSTEP_LANES];
+    unsigned short stack[STACK_SIZE][LOCKSTEP_LANES];
+    uint16_t keys[LOCKSTEP_LANES]; // bit k set while key k is held
+    uint32_t random_state[LOCKSTEP_LANES]; // as Chip8_t.random_state
+    uint32_t active; // bit per lane in use
+    uint64_t diverged_pages; // one bit per 64-byte page that lanes may hold different bytes in
+    unsigned long long lane_steps; // instructions executed, summed over lanes
+    unsigned long long groups; // sets of lanes that executed one instruction together; lane_steps / groups is the
+                               // average number of lanes sharing each dispatch
+    unsigned char memory[LOCKSTEP_LANES][MEMORY_SIZE];
+    uint64_t gfx[LOCKSTEP_LANES][SCREEN_HEIGHT]; // rows as in Chip8_t.gfx
+} Lockstep_t;
+
+void init_lockstep(Lockstep_t *lockstep, int lanes); // the first lanes lanes, each as init_chip8 leaves a machine
+int load_lockstep_rom(Lockstep_t *lockstep, const char *path); // the same ROM into every lane, as load_rom
+void set_lane(Lockstep_t *lockstep, int lane, const Chip8_t *chip8); // copies a machine's state into a lane
+void get_lane(const Lockstep_t *lockstep, int lane, Chip8_t *chip8); // and back, into a machine after init_chip8
+void run_lockstep(Lockstep_t *lockstep, int cycles); // every active lane executes cycles instructions
+void tick_lockstep_timers(Lockstep_t *lockstep); // tick_timers for every lane
+
+#endif //CHIP_8_LOCKSTEP_H
@@ -0,0 +1,281 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+
+#define IMAGE_SIZE sizeof(RewindImage_t)
+#define MAX_LITERALS 128 // control bytes 0x00-0x7F: 1-128 literal bytes follow
+#define MAX_ZEROS 0x8000 // control bytes 0x80-0xFF and one more byte: a run of 1-32768 zeros
+#define MIN_ZEROS 3 // shorter zero runs are cheaper left among the literals
+#define MAX_ENCODED (IMAGE_SIZE + IMAGE_SIZE / MAX_LITERALS + 1) // all literals
+#define ALL_PAGES 0xFFFF
+
+_Static_assert(IMAGE_SIZE % 8 == 0, "RewindImage_t must have no padding and be XORed a word at a time");
+_Static_assert(MAX_ENCODED <= 0xFFFF, "RewindFrame_t.size must hold any frame");
+_Static_assert(MEMORY_PAGES == 16 && offsetof(RewindImage_t, memory) == 0, "pages are a uint16_t mask from 0");
+
+static const RewindImage_t zero_image;
+
+// Brings image up to date with the machine, copying only the memory pages in pages
+static void capture_image(const Chip8_t *chip8, RewindImage_t *image, uint16_t pages) {
+    for (int page = 0; page < MEMORY_PAGES; page++) {
+        if (pages >> page & 1) {
+            memcpy(&image->memory[page * MEMORY_PAGE_SIZE], &chip8->memory[page * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+        }
+    }
+    memcpy(image->gfx, chip8->gfx, sizeof image->gfx);
+    image->random_state = chip8->random_state;
+    memcpy(image->stack, chip8->stack, sizeof image->stack);
+    image->I = chip8->I;
+    image->pc = chip8->pc;
+    memcpy(image->V, chip8->V, REGISTER_SIZE);
+    memcpy(image->keypad, chip8->keypad, sizeof image->keypad);
+    image->sp = chip8->sp;
+    image->delay_timer = chip8->delay_timer;
+    image->sound_timer = chip8->sound_timer;
+    memset(image->unused, 0, sizeof image->unused);
+}
+
+static void restore_image(const RewindImage_t *image, Chip8_t *chip8) {
+    memcpy(chip8->memory, image->memory, MEMORY_SIZE);
+    memcpy(chip8->gfx, image->gfx, sizeof chip8->gfx);
+    chip8->random_state = image->random_state;
+    memcpy(chip8->stack, image->stack, sizeof chip8->stack);
+    chip8->I = image->I;
+    chip8->pc = image->pc;
+    memcpy(chip8->V, image->V, REGISTER_SIZE);
+    memcpy(chip8->keypad, image->keypad, sizeof chip8->keypad);
+    chip8->sp = image->sp;
+    chip8->delay_timer = image->delay_timer;
+    chip8->sound_timer = image->sound_timer;
+
+//    memory was replaced wholesale, and the screen has to be shown again
+    flush_decode_cache(chip8);
+    chip8->dirty_rows = 0xFFFFFFFF;
+    chip8->draw_flag = 1;
+}
+
+// Run-length encodes image XOR base into out, which has room for MAX_ENCODED bytes, and returns the size. Memory
+// pages not in pages are known to be the same in both.
+static size_t encode_image(const RewindImage_t *image, const RewindImage_t *base, uint16_t pages, unsigned char *out) {
+    unsigned char delta[IMAGE_SIZE];
+    const unsigned char *a = (const unsigned char *)image, *b = (const unsigned char *)base;
+    for (size_t i = 0; i < IMAGE_SIZE; i += 8) {
+        if (i < MEMORY_SIZE && !(pages >> (i / MEMORY_PAGE_SIZE) & 1)) {
+            memset(delta + i, 0, MEMORY_PAGE_SIZE);
+            i += MEMORY_PAGE_SIZE - 8;
+            continue;
+        }
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        x ^= y;
+        memcpy(delta + i, &x, 8);
+    }
+
+    size_t size = 0, i = 0;
+    while (i < IMAGE_SIZE) {
+//        a run of zeros: whole words first, since most of the delta is usually unchanged memory
+        size_t zeros = 0;
+        while (i + zeros < IMAGE_SIZE && zeros < MAX_ZEROS && delta[i + zeros] == 0) {
+            size_t at = i + zeros;
+            if (at < MEMORY_SIZE && at % MEMORY_PAGE_SIZE == 0 && !(pages >> (at / MEMORY_PAGE_SIZE) & 1) &&
+                zeros + MEMORY_PAGE_SIZE <= MAX_ZEROS) {
+                zeros += MEMORY_PAGE_SIZE;
+                continue;
+            }
+            uint64_t word = 1;
+            if (at % 8 == 0 && zeros + 8 <= MAX_ZEROS) {
+                memcpy(&word, delta + at, 8);
+            }
+            zeros += word ? 1 : 8;
+        }
+        if (zeros >= MIN_ZEROS || i + zeros == IMAGE_SIZE) {
+            out[size++] = 0x80 | (zeros - 1) >> 8;
+            out[size++] = (zeros - 1) & 0xFF;
+            i += zeros;
+            continue;
+        }
+
+//        literals, up to the next run of zeros worth a token of its own
+        size_t start = i, count = 0;
+        while (i < IMAGE_SIZE && count < MAX_LITERALS) {
+            if (delta[i] == 0 && i + MIN_ZEROS <= IMAGE_SIZE && !delta[i + 1] && !delta[i + 2]) {
+                break;
+            }
+            i++;
+            count++;
+        }
+        out[size++] = count - 1;
+        memcpy(out + size, delta + start, count);
+        size += count;
+    }
+    return size;
+}
+
+// Decodes a frame made by encode_image against base into image
+static void decode_image(const unsigned char *in, size_t size, const RewindImage_t *base, RewindImage_t *image) {
+    const unsigned char *b = (const unsigned char *)base;
+    unsigned char *out = (unsigned char *)image;
+    size_t position = 0, i = 0;
+    while (position < size) {
+        unsigned char control = in[position++];
+        if (control & 0x80) {
+            size_t zeros = ((size_t)(control & 0x7F) << 8 | in[position++]) + 1;
+            memcpy(out + i, b + i, zeros);
+            i += zeros;
+        } else {
+            for (size_t count = (size_t)control + 1; count > 0; count--, i++) {
+                out[i] = b[i] ^ in[position++];
+            }
+        }
+    }
+}
+
+static RewindFrame_t *frame_at(Rewind_t *rewind, int age) {
+    return &rewind->frames[(rewind->first + age) % rewind->max_frames];
+}
+
+// Drops the oldest frame, and with it every frame that was encoded against it
+static void drop_oldest(Rewind_t *rewind) {
+    do {
+        rewind->first = (rewind->first + 1) % rewind->max_frames;
+        rewind->count--;
+    } while (rewind->count > 0 && !frame_at(rewind, 0)->keyframe);
+}
+
+// Makes room for size bytes at head, dropping the oldest frames in the way, and returns where they go
+static size_t reserve(Rewind_t *rewind, size_t size) {
+    if (rewind->count == rewind->max_frames) {
+        drop_oldest(rewind);
+    }
+    if (rewind->head + size > rewind->capacity) {
+//        no room before the end: the frames still stored after head are the oldest, so they go first
+        while (rewind->count > 0 && frame_at(rewind, 0)->offset >= rewind->head) {
+            drop_oldest(rewind);
+        }
+        rewind->head = 0;
+    }
+    while (rewind->count > 0) {
+        const RewindFrame_t *oldest = frame_at(rewind, 0);
+        if (oldest->offset >= rewind->head + size || oldest->offset + oldest->size <= rewind->head) {
+            break;
+        }
+        drop_oldest(rewind);
+    }
+    return rewind->head;
+}
+
+int init_rewind(Rewind_t *rewind, size_t bytes) {
+    if (bytes < REWIND_MIN_BYTES) {
+        bytes = REWIND_MIN_BYTES;
+    }
+    if ((uint64_t)bytes > UINT32_MAX) {
+        bytes = UINT32_MAX; // RewindFrame_t.offset is 32 bits
+    }
+    rewind->max_frames = (int)(bytes / 3 / sizeof(RewindFrame_t));
+    rewind->capacity = bytes - (size_t)rewind->max_frames * sizeof(RewindFrame_t);
+    rewind->data = malloc(rewind->capacity);
+    rewind->frames = malloc((size_t)rewind->max_frames * sizeof(RewindFrame_t));
+    rewind->head = 0;
+    rewind->first = 0;
+    rewind->count = 0;
+    rewind->since_keyframe = 0;
+    rewind->key_pages = 0;
+    rewind->recorded = 0;
+    if (!rewind->data || !rewind->frames) {
+        destroy_rewind(rewind);
+        return 0;
+    }
+    return 1;
+}
+
+void destroy_rewind(Rewind_t *rewind) {
+    free(rewind->data);
+    free(rewind->frames);
+    rewind->data = NULL;
+    rewind->frames = NULL;
+    rewind->count = 0;
+}
+
+void record_frame(Rewind_t *rewind, const Chip8_t *chip8) {
+    unsigned char encoded[MAX_ENCODED];
+    uint16_t changed = dirty_pages(chip8, rewind->seen);
+    if (rewind->recorded == 0) {
+        changed = ALL_PAGES; // last holds nothing yet
+    }
+    capture_image(chip8, &rewind->last, changed);
+    rewind->key_pages |= changed;
+
+    int keyframe = rewind->count == 0 || rewind->since_keyframe + 1 >= REWIND_KEYFRAME_INTERVAL;
+    size_t size = keyframe ? encode_image(&rewind->last, &zero_image, ALL_PAGES, encoded)
+                           : encode_image(&rewind->last, &rewind->key, rewind->key_pages, encoded);
+    size_t offset = reserve(rewind, size);
+    if (!keyframe && rewind->count == 0) {
+//        making room dropped the keyframe this frame was encoded against (only when the buffer holds less than a
+//        keyframe interval), so it starts a new one instead
+        keyframe = 1;
+        size = encode_image(&rewind->last, &zero_image, ALL_PAGES, encoded);
+        offset = reserve(rewind, size);
+    }
+
+    memcpy(rewind->data + offset, encoded, size);
+    rewind->head = offset + size;
+    RewindFrame_t *frame = frame_at(rewind, rewind->count);
+    frame->offset = (uint32_t)offset;
+    frame->size = (uint16_t)size;
+    frame->keyframe = (uint16_t)keyframe;
+    rewind->count++;
+    rewind->recorded++;
+
+    if (keyframe) {
+        rewind->key = rewind->last;
+        rewind->key_pages = 0;
+        rewind->since_keyframe = 0;
+    } else {
+        rewind->since_keyframe++;
+    }
+}
+
+int rewind_frames(Rewind_t *rewind, int frames, Chip8_t *chip8) {
+    if (frames < 0 || frames >= rewind->count) {
+        return 0;
+    }
+
+//    decode the keyframe the target was encoded against, which becomes the one new frames are encoded against
+    int target = rewind->count - 1 - frames;
+    int key = target;
+    while (!frame_at(rewind, key)->keyframe) {
+        key--;
+    }
+    const RewindFrame_t *key_frame = frame_at(rewind, key);
+    decode_image(rewind->data + key_frame->offset, key_frame->size, &zero_image, &rewind->key);
+
+    const RewindFrame_t *target_frame = frame_at(rewind, target);
+    if (target == key) {
+        rewind->last = rewind->key;
+    } else {
+        decode_image(rewind->data + target_frame->offset, target_frame->size, &rewind->key, &rewind->last);
+    }
+    restore_image(&rewind->last, chip8);
+
+//    the machine now matches last, page for page
+    dirty_pages(chip8, rewind->seen);
+    rewind->key_pages = 0;
+    for (int page = 0; page < MEMORY_PAGES; page++) {
+        size_t start = (size_t)page * MEMORY_PAGE_SIZE;
+        if (memcmp(&rewind->last.memory[start], &rewind->key.memory[start], MEMORY_PAGE_SIZE) != 0) {
+            rewind->key_pages |= 1u << page;
+        }
+    }
+
+//    the target is the newest frame now; recording continues right after it
+    rewind->count = target + 1;
+    rewind->head = target_frame->offset + target_frame->size;
+    rewind->since_keyframe = target - key;
+    return 1;
+}
+
+int rewind_depth(const Rewind_t *rewind) {
+    return rewind->count;
+}
@@ -0,0 +1,62 @@
+#ifndef CHIP_8_REWIND_H
+#define CHIP_8_REWIND_H
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+#define REWIND_KEYFRAME_INTERVAL 60 // frames between keyframes: one second of emulated time
+#define REWIND_MIN_BYTES (64 * 1024) // init_rewind uses at least this much, room for several keyframes
+
+// RewindImage_t is the machine as the rewind buffer snapshots it: everything a program can observe, laid out with no
+// padding so that two images can be compared byte for byte
+typedef struct {
+    unsigned char memory[MEMORY_SIZE];
+    uint64_t gfx[SCREEN_HEIGHT];
+    uint32_t random_state;
+    unsigned short stack[STACK_SIZE];
+    unsigned short I;
+    unsigned short pc;
+    unsigned char V[REGISTER_SIZE];
+    unsigned char keypad[16];
+    unsigned char sp;
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+    unsigned char unused[5]; // always zero
+} RewindImage_t;
+
+// RewindFrame_t is where one snapshot is kept in the history
+typedef struct {
+    uint32_t offset; // into Rewind_t.data
+    uint16_t size; // encoded bytes
+    uint16_t keyframe; // encoded on its own rather than against the keyframe before it
+} RewindFrame_t;
+
+// Rewind_t is a ring buffer holding the last frames of one machine, one snapshot per record_frame. A keyframe is a
+// whole image; every other frame is the XOR of its image with the last keyframe's, which is almost all zeros, and
+// both are run-length encoded. Only memory pages that dirty_pages reports are copied into the image, and only pages
+// written since the keyframe are compared with it. When the buffer is full the oldest frames are dropped, a keyframe
+// together with the frames that depend on it. Allocate one with init_rewind and free it with destroy_rewind.
+typedef struct {
+    unsigned char *data; // encoded frames, in the order they were recorded, wrapping around
+    size_t capacity;
+    size_t head; // where the next frame goes
+    RewindFrame_t *frames; // ring of the frames held, oldest first
+    int max_frames;
+    int first; // index in frames of the oldest
+    int count;
+    int since_keyframe; // frames recorded since the newest keyframe, which key holds
+    RewindImage_t key;
+    RewindImage_t last; // the newest frame, kept up to date page by page
+    unsigned int seen[MEMORY_PAGES]; // the machine's page_stores when last was taken
+    uint16_t key_pages; // memory pages where last may differ from key
+    unsigned long long recorded; // frames recorded over the buffer's life, including ones since dropped
+} Rewind_t;
+
+int init_rewind(Rewind_t *rewind, size_t bytes); // bytes in all, a third for the frame index; 0 if out of memory
+void destroy_rewind(Rewind_t *rewind);
+void record_frame(Rewind_t *rewind, const Chip8_t *chip8); // call once per frame
+int rewind_frames(Rewind_t *rewind, int frames, Chip8_t *chip8); // restores the frame recorded frames before the
+                                                                  // newest, dropping those after it; 0 if too far
+int rewind_depth(const Rewind_t *rewind); // frames held, so rewind_frames accepts 0 to this minus one
+
+#endif //CHIP_8_REWIND_H
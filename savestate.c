@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include "savestate.h"
+#include "fontset.h"
+
+#define RANGE_HEADER 4 // start and length, each two bytes
+
+static const unsigned char magic[4] = {'C', '8', 'S', 'T'};
+
+// Stream_t is a struct that contains a buffer being written or read and the position in it. Running past the end
+// sets overflow rather than touching memory outside it, so callers check once at the end.
+typedef struct {
+    unsigned char *data;
+    const unsigned char *input;
+    size_t size;
+    size_t position;
+    int overflow;
+} Stream_t;
+
+static void put_bytes(Stream_t *stream, const void *bytes, size_t count) {
+    if (stream->overflow || stream->size - stream->position < count) {
+        stream->overflow = 1;
+        return;
+    }
+    memcpy(stream->data + stream->position, bytes, count);
+    stream->position += count;
+}
+
+static void put_u8(Stream_t *stream, unsigned int value) {
+    unsigned char byte = value & 0xFF;
+    put_bytes(stream, &byte, 1);
+}
+
+static void put_u16(Stream_t *stream, unsigned int value) {
+    unsigned char bytes[2] = {value & 0xFF, (value >> 8) & 0xFF};
+    put_bytes(stream, bytes, 2);
+}
+
+static void put_u32(Stream_t *stream, uint32_t value) {
+    put_u16(stream, value & 0xFFFF);
+    put_u16(stream, value >> 16);
+}
+
+static const unsigned char *get_bytes(Stream_t *stream, size_t count) {
+    if (stream->overflow || stream->size - stream->position < count) {
+        stream->overflow = 1;
+        return NULL;
+    }
+    const unsigned char *bytes = stream->input + stream->position;
+    stream->position += count;
+    return bytes;
+}
+
+static unsigned int get_u8(Stream_t *stream) {
+    const unsigned char *bytes = get_bytes(stream, 1);
+    return bytes ? bytes[0] : 0;
+}
+
+static unsigned int get_u16(Stream_t *stream) {
+    const unsigned char *bytes = get_bytes(stream, 2);
+    return bytes ? (unsigned int)(bytes[0] | bytes[1] << 8) : 0;
+}
+
+static uint32_t get_u32(Stream_t *stream) {
+    uint32_t low = get_u16(stream);
+    return low | (uint32_t)get_u16(stream) << 16;
+}
+
+// What init_chip8 leaves in memory: the font, then zeros
+static unsigned char initial_byte(int address) {
+    return address < FONTSET_SIZE ? fontset[address] : 0;
+}
+
+size_t save_state(const Chip8_t *chip8, unsigned char *buffer, size_t size) {
+    Stream_t stream = {buffer, NULL, size, 0, 0};
+
+    put_bytes(&stream, magic, sizeof magic);
+    put_u8(&stream, SAVESTATE_VERSION);
+    put_u16(&stream, chip8->pc);
+    put_u16(&stream, chip8->I);
+    put_u8(&stream, chip8->sp);
+    put_u8(&stream, chip8->delay_timer);
+    put_u8(&stream, chip8->sound_timer);
+    put_bytes(&stream, chip8->V, REGISTER_SIZE);
+    for (int i = 0; i < STACK_SIZE; i++) {
+        put_u16(&stream, chip8->stack[i]);
+    }
+    unsigned int keys = 0;
+    for (int k = 0; k < 16; k++) {
+        keys |= (unsigned int)(chip8->keypad[k] != 0) << k;
+    }
+    put_u16(&stream, keys);
+    put_u32(&stream, chip8->random_state);
+
+//    the screen: only rows with something on them
+    uint32_t rows = 0;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        rows |= (uint32_t)(chip8->gfx[y] != 0) << y;
+    }
+    put_u32(&stream, rows);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        if (rows >> y & 1) {
+            put_u32(&stream, chip8->gfx[y] & 0xFFFFFFFF);
+            put_u32(&stream, chip8->gfx[y] >> 32);
+        }
+    }
+
+//    memory: runs of bytes that differ from init_chip8's, where a gap too short to pay for another range header
+//    joins two runs into one. The count goes in front, so it is written once the ranges are.
+    size_t count_position = stream.position;
+    put_u16(&stream, 0);
+    unsigned int ranges = 0;
+    int address = 0;
+    while (address < MEMORY_SIZE) {
+//        past the font, untouched memory is zero and is skipped a word at a time
+        uint64_t word;
+        if (address >= FONTSET_SIZE && address % 8 == 0) {
+            memcpy(&word, &chip8->memory[address], sizeof word);
+            if (!word) {
+                address += 8;
+                continue;
+            }
+        }
+        if (chip8->memory[address] == initial_byte(address)) {
+            address++;
+            continue;
+        }
+
+        int start = address, end = address + 1, gap = 0;
+        for (address++; address < MEMORY_SIZE && gap <= RANGE_HEADER; address++) {
+            if (chip8->memory[address] == initial_byte(address)) {
+                gap++;
+            } else {
+                end = address + 1;
+                gap = 0;
+            }
+        }
+        address = end;
+
+        put_u16(&stream, start);
+        put_u16(&stream, end - start);
+        put_bytes(&stream, &chip8->memory[start], end - start);
+        ranges++;
+    }
+
+    if (stream.overflow) {
+        return 0;
+    }
+    buffer[count_position] = ranges & 0xFF;
+    buffer[count_position + 1] = ranges >> 8;
+    return stream.position;
+}
+
+int load_state(Chip8_t *chip8, const unsigned char *buffer, size_t size) {
+    Stream_t stream = {NULL, buffer, size, 0, 0};
+
+    const unsigned char *header = get_bytes(&stream, sizeof magic);
+    if (!header || memcmp(header, magic, sizeof magic) != 0 || get_u8(&stream) != SAVESTATE_VERSION) {
+        return 0;
+    }
+
+//    read everything into locals first, so that a truncated or corrupt state leaves the machine as it was
+    unsigned int pc = get_u16(&stream);
+    unsigned int I = get_u16(&stream);
+    unsigned int sp = get_u8(&stream);
+    unsigned int delay_timer = get_u8(&stream);
+    unsigned int sound_timer = get_u8(&stream);
+    const unsigned char *V = get_bytes(&stream, REGISTER_SIZE);
+    unsigned short stack[STACK_SIZE];
+    for (int i = 0; i < STACK_SIZE; i++) {
+        stack[i] = get_u16(&stream);
+    }
+    unsigned int keys = get_u16(&stream);
+    uint32_t random_state = get_u32(&stream);
+
+    uint64_t gfx[SCREEN_HEIGHT];
+    uint32_t rows = get_u32(&stream);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        gfx[y] = 0;
+        if (rows >> y & 1) {
+            uint64_t low = get_u32(&stream);
+            gfx[y] = low | (uint64_t)get_u32(&stream) << 32;
+        }
+    }
+
+    unsigned char memory[MEMORY_SIZE];
+    memset(memory, 0, sizeof memory);
+    memcpy(memory, fontset, FONTSET_SIZE);
+    unsigned int ranges = get_u16(&stream);
+    for (unsigned int r = 0; r < ranges && !stream.overflow; r++) {
+        unsigned int start = get_u16(&stream);
+        unsigned int length = get_u16(&stream);
+        const unsigned char *bytes = get_bytes(&stream, length);
+        if (!bytes || start + length > MEMORY_SIZE) {
+            return 0;
+        }
+        memcpy(&memory[start], bytes, length);
+    }
+
+//    a zero random state would leave Cxkk's xorshift stuck at zero forever, so no machine can have one
+    if (stream.overflow || stream.position != size || pc > MEMORY_SIZE || sp >= STACK_SIZE || random_state == 0) {
+        return 0;
+    }
+
+    chip8->pc = pc;
+    chip8->I = I;
+    chip8->sp = sp;
+    chip8->delay_timer = delay_timer;
+    chip8->sound_timer = sound_timer;
+    memcpy(chip8->V, V, REGISTER_SIZE);
+    memcpy(chip8->stack, stack, sizeof stack);
+    for (int k = 0; k < 16; k++) {
+        chip8->keypad[k] = keys >> k & 1;
+    }
+    chip8->random_state = random_state;
+    memcpy(chip8->gfx, gfx, sizeof gfx);
+    memcpy(chip8->memory, memory, MEMORY_SIZE);
+
+//    memory was replaced wholesale, and the screen has to be shown again
+    flush_decode_cache(chip8);
+    chip8->dirty_rows = 0xFFFFFFFF;
+    chip8->draw_flag = 1;
+    return 1;
+}
+
+int save_state_file(const Chip8_t *chip8, const char *path) {
+    unsigned char buffer[SAVESTATE_MAX_SIZE];
+    size_t size = save_state(chip8, buffer, sizeof buffer);
+    if (size == 0) {
+        return 0;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return 0;
+    }
+    int written = fwrite(buffer, 1, size, file) == size;
+    return fclose(file) == 0 && written;
+}
+
+int load_state_file(Chip8_t *chip8, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+
+    unsigned char buffer[SAVESTATE_MAX_SIZE];
+    size_t size = fread(buffer, 1, sizeof buffer, file);
+    int too_long = fgetc(file) != EOF;
+    fclose(file);
+    return !too_long && load_state(chip8, buffer, size);
+}
@@ -0,0 +1,29 @@
+#ifndef CHIP_8_SAVESTATE_H
+#define CHIP_8_SAVESTATE_H
+#include <stddef.h>
+#include "cpu.h"
+
+#define SAVESTATE_VERSION 1 // bumped whenever the layout changes; load_state rejects versions it doesn't know
+#define SAVESTATE_MAX_SIZE (2 * MEMORY_SIZE) // no state is bigger than this, whatever memory holds
+
+// A save state is the whole machine as a program can observe it: memory, V, the stack, sp, I, pc, the timers, the
+// keypad, the screen and Cxkk's random state. Caches and statistics are left out and rebuilt after loading. The
+// format is little-endian bytes, the same on every host:
+//
+//   "C8ST", version                                  5 bytes
+//   pc, I (2 each), sp, delay, sound timers          7
+//   V0-VF                                            16
+//   stack (2 each)                                   32
+//   keypad (bit k for key k), random state           6
+//   row mask, then each row it has set as 8 bytes    4 + 8 per lit row
+//   range count, then per range: start, length and   2 + 4 per range + its bytes
+//   the bytes of memory that differ from init_chip8's
+//
+// so a ROM of a few hundred bytes with a few sprites on screen saves in a few hundred bytes.
+size_t save_state(const Chip8_t *chip8, unsigned char *buffer, size_t size); // bytes written; 0 if size is too small
+int load_state(Chip8_t *chip8, const unsigned char *buffer, size_t size); // into a machine after init_chip8; returns
+                                                                          // 0, changing nothing, if it isn't a state
+int save_state_file(const Chip8_t *chip8, const char *path);
+int load_state_file(Chip8_t *chip8, const char *path);
+
+#endif //CHIP_8_SAVESTATE_H
@@ -0,0 +1,145 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE // clock_nanosleep
+#endif
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+#include "scheduler.h"
+
+#if defined(_WIN32) && !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002 // Windows 10 1803 and later; older mingw headers lack it
+#endif
+
+void init_scheduler(Scheduler_t *scheduler) {
+    scheduler->period = SDL_GetPerformanceFrequency() / FRAME_RATE;
+    scheduler->start = SDL_GetPerformanceCounter();
+    scheduler->frames = 0;
+    scheduler->late_frames = 0;
+    scheduler->dropped_frames = 0;
+    scheduler->total_lateness = 0;
+    scheduler->worst_lateness = 0;
+    scheduler->waits = 0;
+    scheduler->total_oversleep = 0;
+    scheduler->worst_oversleep = 0;
+    scheduler->last_frame = scheduler->start;
+#ifdef _WIN32
+    scheduler->timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+#endif
+}
+
+void destroy_scheduler(Scheduler_t *scheduler) {
+#ifdef _WIN32
+    if (scheduler->timer) {
+        CloseHandle(scheduler->timer);
+        scheduler->timer = NULL;
+    }
+#else
+    (void)scheduler;
+#endif
+}
+
+static void record_wake(Scheduler_t *scheduler, Uint64 deadline) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint64 oversleep = now > deadline ? now - deadline : 0; // SDL_Delay rounds down, so it can wake a little early
+    scheduler->waits++;
+    scheduler->total_oversleep += oversleep;
+    if (oversleep > scheduler->worst_oversleep) {
+        scheduler->worst_oversleep = oversleep;
+    }
+    scheduler->last_frame = now;
+}
+
+// Sleeps until the performance counter reaches deadline
+static void sleep_until(Scheduler_t *scheduler, Uint64 deadline) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (now >= deadline) {
+        return;
+    }
+    double seconds = (double)(deadline - now) / (double)SDL_GetPerformanceFrequency();
+
+#if defined(_WIN32)
+    if (scheduler->timer) {
+        LARGE_INTEGER due;
+        due.QuadPart = -(LONGLONG)(seconds * 1e7); // negative: relative, in 100 ns units
+        if (SetWaitableTimer(scheduler->timer, &due, 0, NULL, NULL, FALSE)) {
+            WaitForSingleObject(scheduler->timer, INFINITE);
+            return;
+        }
+    }
+    SDL_Delay((Uint32)(seconds * 1000));
+#elif defined(__APPLE__)
+    (void)scheduler;
+    struct timespec wait = {(time_t)seconds, (long)((seconds - (double)(time_t)seconds) * 1e9)};
+    while (nanosleep(&wait, &wait) == -1 && errno == EINTR) {
+    }
+#else
+    (void)scheduler;
+//    an absolute wake-up time, so that being interrupted and sleeping again doesn't add up
+    struct timespec wake;
+    clock_gettime(CLOCK_MONOTONIC, &wake);
+    long long nanoseconds = wake.tv_nsec + (long long)(seconds * 1e9);
+    wake.tv_sec += (time_t)(nanoseconds / 1000000000);
+    wake.tv_nsec = (long)(nanoseconds % 1000000000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+    }
+#endif
+}
+
+void wait_next_frame(Scheduler_t *scheduler) {
+    scheduler->frames++;
+    Uint64 deadline = scheduler->start + scheduler->frames * scheduler->period;
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    if (now >= deadline) {
+        Uint64 lateness = now - deadline;
+        scheduler->late_frames++;
+        scheduler->total_lateness += lateness;
+        if (lateness > scheduler->worst_lateness) {
+            scheduler->worst_lateness = lateness;
+        }
+
+//        too far behind to catch up (e.g. the process was suspended): skip the missed frames instead of racing them
+        if (lateness > SCHEDULER_MAX_BEHIND * scheduler->period) {
+            Uint64 missed = lateness / scheduler->period;
+            scheduler->dropped_frames += missed;
+            scheduler->frames += missed;
+        }
+        scheduler->last_frame = now;
+        return;
+    }
+
+    sleep_until(scheduler, deadline);
+    record_wake(scheduler, deadline);
+}
+
+void print_scheduler_stats(const Scheduler_t *scheduler) {
+    if (!scheduler->frames) {
+        return;
+    }
+
+    double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+//    drift: how far the latest frame started from where a perfect FRAME_RATE clock would have put it
+    double drift = (double)scheduler->last_frame - (double)(scheduler->start + scheduler->frames * scheduler->period);
+    printf(
+        "%llu frames scheduled, %llu dropped, drift %.3f ms\n",
+        (unsigned long long)scheduler->frames,
+        (unsigned long long)scheduler->dropped_frames,
+        drift * ms_per_tick
+    );
+    printf(
+        "%llu frames on time, woken %.3f ms after the deadline on average, %.3f ms worst\n",
+        (unsigned long long)scheduler->waits,
+        scheduler->waits ? (double)scheduler->total_oversleep / (double)scheduler->waits * ms_per_tick : 0,
+        (double)scheduler->worst_oversleep * ms_per_tick
+    );
+    printf(
+        "%llu frames late, started %.3f ms after the deadline on average, %.3f ms worst\n",
+        (unsigned long long)scheduler->late_frames,
+        scheduler->late_frames ? (double)scheduler->total_lateness / (double)scheduler->late_frames * ms_per_tick : 0,
+        (double)scheduler->worst_lateness * ms_per_tick
+    );
+}
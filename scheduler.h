@@ -0,0 +1,35 @@
+#ifndef CHIP_8_SCHEDULER_H
+#define CHIP_8_SCHEDULER_H
+#include "SDL.h"
+
+#define FRAME_RATE 60 // frames per second; the delay and sound timers tick once per frame
+#define SCHEDULER_MAX_BEHIND 6 // frames the scheduler catches up on before giving up and starting afresh
+
+// Scheduler_t paces frames against SDL_GetPerformanceCounter. Deadlines are absolute (start + n frames), so error
+// from one late wake-up never accumulates, and a frame that ran late is caught up by starting the next one straight
+// away. Waiting is one sleep to the deadline on the finest timer the system has: clock_nanosleep on CLOCK_MONOTONIC
+// (nanosleep on macOS), a high-resolution waitable timer on Windows, falling back to SDL_Delay for the whole
+// milliseconds left where there is none. It never spins, so an idle window costs next to nothing.
+typedef struct {
+    Uint64 period; // counter ticks per frame
+    Uint64 start; // counter value the first frame was due
+    Uint64 frames; // frames scheduled so far, including dropped ones
+    Uint64 late_frames; // frames that started after their deadline
+    Uint64 dropped_frames; // frames skipped after falling more than SCHEDULER_MAX_BEHIND behind
+    Uint64 total_lateness; // summed over late frames, in counter ticks
+    Uint64 worst_lateness;
+    Uint64 waits; // frames that were waited for, the on-time ones
+    Uint64 total_oversleep; // how long after the deadline those waits returned, in counter ticks
+    Uint64 worst_oversleep;
+    Uint64 last_frame; // counter value the latest frame started at
+#ifdef _WIN32
+    void *timer; // high-resolution waitable timer, NULL where Windows has none
+#endif
+} Scheduler_t;
+
+void init_scheduler(Scheduler_t *scheduler); // and destroy_scheduler on the same thread once done
+void destroy_scheduler(Scheduler_t *scheduler);
+void wait_next_frame(Scheduler_t *scheduler); // returns when the next frame is due
+void print_scheduler_stats(const Scheduler_t *scheduler);
+
+#endif //CHIP_8_SCHEDULER_H